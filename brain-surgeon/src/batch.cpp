@@ -0,0 +1,80 @@
+#include "batch.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+
+struct PendingReport {
+    FileReport report;
+    bool done = false;
+};
+
+int run_batch(ThreadPool& pool, const PathSource& next_path, const FileProcessor& process, std::ostream& out, std::ostream& err) {
+    // Reports not written yet, the first one belonging to path number first_index
+    std::deque<PendingReport> pending;
+    size_t first_index = 0;
+    size_t max_pending = pool.size() * 16;
+    int status = 0;
+
+    std::mutex mutex;
+    std::condition_variable has_room;
+    std::string path;
+
+    while (next_path(path)) {
+        size_t index;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            has_room.wait(lock, [&]() { return pending.size() < max_pending; });
+
+            index = first_index + pending.size();
+            pending.emplace_back();
+        }
+
+        pool.submit([&, index, path]() {
+            FileReport report;
+            try {
+                report = process(path);
+            } catch (const std::exception& e) {
+                report.err = "Error: " + path + ": " + e.what() + "\n";
+                report.status = 1;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            pending[index - first_index] = { std::move(report), true };
+
+            // Whoever completes the oldest outstanding file writes every
+            // report that is ready in order
+            while (!pending.empty() && pending.front().done) {
+                const FileReport& ready = pending.front().report;
+
+                out << ready.out;
+                err << ready.err;
+                status = std::max(status, ready.status);
+
+                pending.pop_front();
+                first_index++;
+            }
+            has_room.notify_one();
+        });
+    }
+
+    pool.wait();
+    out.flush();
+    return status;
+}
+
+int run_batch(ThreadPool& pool, const std::vector<std::string>& paths, const FileProcessor& process, std::ostream& out, std::ostream& err) {
+    size_t next = 0;
+
+    return run_batch(
+        pool,
+        [&](std::string& path) {
+            if (next == paths.size()) {
+                return false;
+            }
+            path = paths[next++];
+            return true;
+        },
+        process, out, err);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "thread_pool.hpp"
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Everything one file of a batch printed, kept until it is its turn
+struct FileReport {
+    std::string out;
+    std::string err;
+    int status = 0;
+};
+
+using FileProcessor = std::function<FileReport(const std::string& path)>;
+
+// Produces the next path to process, or returns false when there are no more
+using PathSource = std::function<bool(std::string& path)>;
+
+// Process every path on the pool. Reports are written in the order the paths
+// came in, each as soon as it and all reports before it are done, so the
+// output is stable whatever order the files finish in. Paths are pulled only
+// while few enough files are in flight, so a slow consumer bounds memory.
+// Returns the highest status.
+int run_batch(ThreadPool& pool, const PathSource& next_path, const FileProcessor& process, std::ostream& out, std::ostream& err);
+int run_batch(ThreadPool& pool, const std::vector<std::string>& paths, const FileProcessor& process, std::ostream& out, std::ostream& err);
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// Blocking FIFO with a fixed capacity: producers wait while it is full and
+// consumers wait while it is empty, until the producers close() it
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity): capacity(capacity) {}
+
+    // Returns false if the queue was closed before there was room
+    bool push(T value) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this]() { return closed || items.size() < capacity; });
+
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(value));
+        not_empty.notify_one();
+        return true;
+    }
+
+    // Returns false once the queue is closed and drained
+    bool pop(T& value) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this]() { return closed || !items.empty(); });
+
+        if (items.empty()) {
+            return false;
+        }
+        value = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+private:
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+};
@@ -0,0 +1,342 @@
+#pragma once
+
+#include "cancellation.hpp"
+#include "format_cache.hpp"
+#include "formatter_config.hpp"
+#include "output_buffer.hpp"
+#include "parser.hpp"
+#include <algorithm>
+#include <string>
+#include <string_view>
+
+// Writes formatted code for the statements of an AST, or for the events
+// format_tokens() produces while reading, into an OutputBuffer
+class BrainfuckFormatter {
+private:
+    const FormatterConfig& config;
+    OutputBuffer& output;
+    int current_indent_level = 0;
+
+    // Indentation for every depth seen so far, sliced instead of rebuilt per line
+    std::string indent_table;
+    size_t indent_width;
+
+    // State of the line being built; it is reused for every line so that
+    // formatting does not allocate once the buffers have warmed up
+    std::string current_line;
+    bool line_has_content = false; // a command group was already added to the line
+    size_t group_length = 0;       // commands in the group currently being written
+    TokenType last_command_type = TokenType::WHITESPACE;
+    std::string pending_comment;
+
+    // Rendered loops reused across calls
+    FormatCache* cache = nullptr;
+    uint64_t cache_config = 0;
+
+    // Checked every CANCELLATION_INTERVAL statements when set
+    const CancellationToken* cancel = nullptr;
+    unsigned until_check = CANCELLATION_INTERVAL;
+
+    // Convert command token to its character representation
+    static char command_to_char(TokenType type) {
+        switch (type) {
+            case TokenType::MOVE_RIGHT: return '>';
+            case TokenType::MOVE_LEFT: return '<';
+            case TokenType::INCREMENT: return '+';
+            case TokenType::DECREMENT: return '-';
+            case TokenType::OUTPUT: return '.';
+            case TokenType::INPUT: return ',';
+            default: return '\0';
+        }
+    }
+
+    // Check if two commands are in the same group (same operation type)
+    static bool are_same_group(TokenType a, TokenType b) {
+        // Movement group: < and >
+        if ((a == TokenType::MOVE_LEFT || a == TokenType::MOVE_RIGHT) && (b == TokenType::MOVE_LEFT || b == TokenType::MOVE_RIGHT)) {
+            return true;
+        }
+        // Increment/decrement group: + and -
+        if ((a == TokenType::INCREMENT || a == TokenType::DECREMENT) && (b == TokenType::INCREMENT || b == TokenType::DECREMENT)) {
+            return true;
+        }
+        // Same exact command
+        return a == b;
+    }
+
+    // Check if command is a movement command
+    static bool is_movement_command(TokenType type) {
+        return type == TokenType::MOVE_LEFT || type == TokenType::MOVE_RIGHT;
+    }
+
+    // Check if command is an I/O command
+    static bool is_io_command(TokenType type) {
+        return type == TokenType::INPUT || type == TokenType::OUTPUT;
+    }
+
+    // Indentation of the current level, grown once per new maximum depth
+    std::string_view get_indent() {
+        size_t width = static_cast<size_t>(current_indent_level) * indent_width;
+
+        if (indent_table.size() < width) {
+            indent_table.append(width - indent_table.size(), config.tab_indent ? '\t' : ' ');
+        }
+        return std::string_view(indent_table.data(), width);
+    }
+
+    // Close the current command group
+    void flush_command_buffer() {
+        if (group_length > 0) {
+            group_length = 0;
+            line_has_content = true;
+        }
+    }
+
+    void flush_current_line() {
+        flush_command_buffer();
+        if (line_has_content) {
+            output.write(get_indent());
+            output.write(current_line);
+            output.put('\n');
+            output.maybe_flush();
+        }
+        current_line.clear();
+        line_has_content = false;
+    }
+
+    void flush_pending_comment() {
+        if (!pending_comment.empty()) {
+            if (config.comment_on_newline && line_has_content) {
+                flush_current_line();
+            }
+
+            output.write(get_indent());
+
+            // Only prepend the prefix if the comment does not already start with it
+            const std::string& prefix = config.comment_prefix;
+            if (prefix.empty() || pending_comment.compare(0, prefix.length(), prefix) != 0) {
+                output.write(prefix);
+            }
+            output.write(pending_comment);
+            output.put('\n');
+            output.maybe_flush();
+
+            pending_comment.clear();
+        }
+    }
+
+public:
+    BrainfuckFormatter(const FormatterConfig& cfg, OutputBuffer& out, FormatCache* format_cache = nullptr):
+        config(cfg),
+        output(out),
+        indent_width(cfg.tab_indent ? 1 : static_cast<size_t>(std::max(cfg.indent_spaces, 0))),
+        cache(format_cache),
+        cache_config(format_cache != nullptr ? config_fingerprint(cfg) : 0) {}
+
+    void command(TokenType type) {
+        flush_pending_comment();
+
+        // Check if we need to start a new command group
+        if (group_length > 0 && !are_same_group(last_command_type, type)) {
+            flush_command_buffer();
+        }
+
+        // Handle newline BEFORE movement groups
+        if (is_movement_command(type) && config.move_on_newline && group_length == 0 && line_has_content) {
+            flush_current_line();
+        }
+
+        // Add command to the group, with tally marks every five commands
+        if (group_length == 0) {
+            if (line_has_content && config.space_between_groups) {
+                current_line += ' ';
+            }
+        } else if (config.tally_commands && group_length % 5 == 0) {
+            current_line += ' ';
+        }
+        current_line += command_to_char(type);
+        group_length++;
+        last_command_type = type;
+
+        // Handle newline after I/O commands
+        if (is_io_command(type) && config.end_line_at_io) {
+            flush_current_line();
+        }
+    }
+
+    void comment(std::string_view text) {
+        if (!pending_comment.empty()) {
+            pending_comment += ' ';
+        }
+        pending_comment.append(text.data(), text.size());
+    }
+
+    void loop_start() {
+        flush_pending_comment();
+        flush_current_line();
+        open_loop();
+    }
+
+    void open_loop() {
+        output.write(get_indent());
+        output.write(config.loop_on_newline ? "[\n" : "[");
+        current_indent_level++;
+    }
+
+    void loop_end() {
+        finish();
+        current_indent_level--;
+
+        if (config.loop_on_newline) {
+            output.write(get_indent());
+        }
+        output.write("]\n");
+        output.maybe_flush();
+    }
+
+    void unmatched_close() {
+        flush_pending_comment();
+        flush_current_line();
+
+        output.write(get_indent());
+        output.write("]\n");
+        output.maybe_flush();
+    }
+
+    bool is_stopped() const { return output.is_stopped(); }
+
+    void set_cancellation(const CancellationToken* token) { cancel = token; }
+
+    // Flush any remaining content of the current statement sequence
+    void finish() {
+        flush_pending_comment();
+        flush_current_line();
+    }
+
+    void format_statement(const ASTNode* stmt) {
+        switch (stmt->type) {
+            case NodeType::COMMAND: command(static_cast<const CommandNode*>(stmt)->command); break;
+
+            case NodeType::LOOP: {
+                const auto* loop = static_cast<const LoopNode*>(stmt);
+
+                if (cache != nullptr) {
+                    format_cached_loop(loop);
+                    break;
+                }
+
+                loop_start();
+                format_statements(loop->body);
+                loop_end();
+                break;
+            }
+
+            case NodeType::COMMENT: comment(static_cast<const CommentNode*>(stmt)->text); break;
+            case NodeType::UNMATCHED_CLOSE: unmatched_close(); break;
+            default: break;
+        }
+    }
+
+    // A loop always starts and ends with a clean line, so its text only
+    // depends on its structure, the indentation and the configuration
+    void format_cached_loop(const LoopNode* loop) {
+        flush_pending_comment();
+        flush_current_line();
+
+        if (loop->subtree_size < FormatCache::MIN_CACHED_NODES) {
+            open_loop();
+            format_statements(loop->body);
+            loop_end();
+            return;
+        }
+
+        SubtreeKey key { loop->structure_hash, loop->subtree_size, current_indent_level, cache_config };
+
+        if (const std::string* text = cache->find(key)) {
+            cache->hits++;
+            output.write(*text);
+            output.maybe_flush();
+            return;
+        }
+
+        cache->misses++;
+        size_t mark = output.bytes_written();
+
+        open_loop();
+        format_statements(loop->body);
+        loop_end();
+
+        // Only remember the text if it was not flushed out in the meantime
+        std::string_view buffered = output.buffered();
+        size_t buffer_start = output.bytes_written() - buffered.size();
+        if (mark >= buffer_start) {
+            cache->insert(key, buffered.substr(mark - buffer_start));
+        }
+    }
+
+    // Format a sequence of statements
+    void format_statements(const std::vector<std::unique_ptr<ASTNode>>& statements) {
+        for (const auto& stmt: statements) {
+            // The consumer of the output has seen enough (e.g. fmt --check)
+            if (output.is_stopped()) {
+                return;
+            }
+            if (cancel != nullptr && --until_check == 0) {
+                until_check = CANCELLATION_INTERVAL;
+                cancel->check();
+            }
+            format_statement(stmt.get());
+        }
+    }
+
+    void format(const ProgramNode* program) {
+        current_indent_level = 0;
+
+        if (program != nullptr && !program->statements.empty()) {
+            format_statements(program->statements);
+            finish();
+        }
+
+        output.flush();
+    }
+};
+
+// Feed the tokens read from input_fd to a BrainfuckFormatter, or to any other
+// class with the same event methods (see Minifier). Returns the number of
+// bytes read, which is also known for pipes.
+template <typename Formatter>
+size_t format_tokens(int input_fd, Formatter& formatter) {
+    ChunkedLexer lexer(input_fd);
+    Token token;
+    size_t depth = 0;
+
+    // Same events as format_statements() produces from the AST: the parser
+    // turns every ']' without an open loop into an unmatched close and
+    // closes all loops still open at the end of the input
+    while (!formatter.is_stopped() && lexer.next(token)) {
+        switch (token.type) {
+            case TokenType::LOOP_START:
+                formatter.loop_start();
+                depth++;
+                break;
+            case TokenType::LOOP_END:
+                if (depth > 0) {
+                    formatter.loop_end();
+                    depth--;
+                } else {
+                    formatter.unmatched_close();
+                }
+                break;
+            case TokenType::COMMENT: formatter.comment(token.text); break;
+            case TokenType::WHITESPACE:
+            case TokenType::NEWLINE: break;
+            default: formatter.command(token.type); break;
+        }
+    }
+
+    for (; depth > 0; depth--) {
+        formatter.loop_end();
+    }
+    formatter.finish();
+    return lexer.bytes_read();
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+
+// Thrown at a checkpoint once the work it belongs to has been superseded
+class OperationCancelled: public std::exception {
+public:
+    const char* what() const noexcept override { return "Operation cancelled"; }
+};
+
+// Set from another thread to stop work that is no longer needed; long loops
+// call check() every so often and unwind with OperationCancelled
+class CancellationToken {
+public:
+    void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+    bool is_cancelled() const { return cancelled.load(std::memory_order_relaxed); }
+
+    void check() const {
+        if (is_cancelled()) {
+            throw OperationCancelled();
+        }
+    }
+
+private:
+    std::atomic<bool> cancelled { false };
+};
+
+// Statements handled between two cancellation checks
+constexpr unsigned CANCELLATION_INTERVAL = 1024;
@@ -0,0 +1,162 @@
+#include "file_io.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A file opened for reading, closed again when the scope ends. STDIN_PATH
+// reads standard input, which is left open.
+class ReadDescriptor {
+public:
+    explicit ReadDescriptor(const std::string& filename): fd(filename == STDIN_PATH ? STDIN_FILENO : open(filename.c_str(), O_RDONLY)) {
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open file: " + filename);
+        }
+    }
+    ~ReadDescriptor() {
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+    }
+
+    ReadDescriptor(const ReadDescriptor&) = delete;
+    ReadDescriptor& operator=(const ReadDescriptor&) = delete;
+
+    // Size of a regular file that is read from its start, 0 for anything else
+    size_t regular_size() const {
+        struct stat info;
+        if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || lseek(fd, 0, SEEK_CUR) != 0) {
+            return 0;
+        }
+        return static_cast<size_t>(info.st_size);
+    }
+
+    const int fd;
+};
+
+// Read everything left in fd, straight into content; size_hint is the
+// expected size, if known, so a regular file is read without reallocating
+static void read_all(int fd, const std::string& filename, std::string& content, size_t size_hint) {
+    size_t length = 0;
+    content.resize(std::max<size_t>(size_hint + 1, 64 * 1024));
+
+    while (true) {
+        if (length == content.size()) {
+            content.resize(content.size() * 2);
+        }
+
+        ssize_t count = ::read(fd, &content[length], content.size() - length);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            throw std::runtime_error("Cannot read file: " + filename + " (" + std::strerror(errno) + ")");
+        }
+        if (count == 0) {
+            break;
+        }
+        length += static_cast<size_t>(count);
+    }
+
+    content.resize(length);
+}
+
+std::string read_file(const std::string& filename) {
+    ReadDescriptor file(filename);
+    std::string content;
+
+    read_all(file.fd, filename, content, file.regular_size());
+    return content;
+}
+
+void write_file(const std::string& filename, std::string_view content) {
+    AtomicFile file(filename);
+
+    while (!content.empty()) {
+        ssize_t count = ::write(file.fd(), content.data(), content.size());
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            throw std::runtime_error("Cannot write to file: " + filename + " (" + std::strerror(errno) + ")");
+        }
+        content.remove_prefix(static_cast<size_t>(count));
+    }
+
+    file.commit();
+}
+
+bool update_file(const std::string& filename, std::string_view content, std::string_view original) {
+    if (content == original) {
+        return false;
+    }
+    write_file(filename, content);
+    return true;
+}
+
+// Writing through a symlink has to replace the file it points to, not the
+// link itself, so the temporary file goes next to the resolved path
+static std::string resolve_link(const std::string& path) {
+    char* resolved = realpath(path.c_str(), nullptr);
+
+    if (resolved == nullptr) {
+        return path;
+    }
+
+    std::string result(resolved);
+    free(resolved);
+    return result;
+}
+
+AtomicFile::AtomicFile(const std::string& target): target(resolve_link(target)), temp_path(this->target + ".XXXXXX") {
+    file = mkstemp(temp_path.data());
+    if (file < 0) {
+        throw std::runtime_error("Cannot create temporary file for: " + target + " (" + std::strerror(errno) + ")");
+    }
+
+    // Keep the owner and permissions of the file that is being replaced.
+    // Changing the owner needs privileges, so it is best effort.
+    struct stat info;
+    if (stat(this->target.c_str(), &info) == 0) {
+        if (info.st_uid != geteuid() || info.st_gid != getegid()) {
+            int ignored = fchown(file, info.st_uid, info.st_gid);
+            (void)ignored;
+        }
+        fchmod(file, info.st_mode & 07777);
+    }
+}
+
+AtomicFile::~AtomicFile() {
+    if (file >= 0) {
+        close(file);
+        unlink(temp_path.c_str());
+    }
+}
+
+void AtomicFile::commit() {
+    int fd = file;
+    file = -1;
+
+    // Flush the data before the rename, or a crash can leave the new name
+    // pointing at an empty file. The descriptor is closed either way.
+    bool ok = fsync(fd) == 0;
+    int error = errno;
+
+    if (close(fd) != 0 && ok) {
+        ok = false;
+        error = errno;
+    }
+    if (ok && rename(temp_path.c_str(), target.c_str()) != 0) {
+        ok = false;
+        error = errno;
+    }
+    if (!ok) {
+        unlink(temp_path.c_str());
+        throw std::runtime_error("Cannot write to file: " + target + " (" + std::strerror(error) + ")");
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// The path that names standard input instead of a file
+constexpr const char* STDIN_PATH = "-";
+
+std::string read_file(const std::string& filename);
+
+// Replace the file atomically, so readers never see a partially written file
+void write_file(const std::string& filename, std::string_view content);
+
+// Write content only if it differs from the original text of the file, so
+// that unchanged files keep their mtime. Returns whether it was written.
+bool update_file(const std::string& filename, std::string_view content, std::string_view original);
+
+// A temporary file next to target that replaces it atomically on commit().
+// It is removed again if it is destroyed without being committed.
+class AtomicFile {
+public:
+    explicit AtomicFile(const std::string& target);
+    ~AtomicFile();
+
+    AtomicFile(const AtomicFile&) = delete;
+    AtomicFile& operator=(const AtomicFile&) = delete;
+
+    int fd() const { return file; }
+    void commit();
+
+private:
+    std::string target;
+    std::string temp_path;
+    int file = -1;
+};
@@ -0,0 +1,389 @@
+#include "file_walker.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <sys/stat.h>
+
+// Match a bracket expression starting after '[' against c; pattern_end is
+// set past the closing ']'. Returns false for an unterminated expression.
+static bool match_class(std::string_view pattern, size_t start, char c, size_t& pattern_end, bool& matched) {
+    size_t i = start;
+    bool negated = i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^');
+    if (negated) {
+        i++;
+    }
+
+    matched = false;
+    bool first = true;
+
+    while (i < pattern.size() && (pattern[i] != ']' || first)) {
+        char low = pattern[i];
+        if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+            matched |= (c >= low && c <= pattern[i + 2]);
+            i += 3;
+        } else {
+            matched |= (c == low);
+            i++;
+        }
+        first = false;
+    }
+
+    if (i >= pattern.size()) {
+        return false;
+    }
+
+    matched ^= negated;
+    pattern_end = i + 1;
+    return true;
+}
+
+bool glob_match(std::string_view pattern, std::string_view text) {
+    size_t p = 0;
+    size_t t = 0;
+
+    while (p < pattern.size()) {
+        char c = pattern[p];
+
+        if (c == '*') {
+            bool any_depth = p + 1 < pattern.size() && pattern[p + 1] == '*';
+            while (p < pattern.size() && pattern[p] == '*') {
+                p++;
+            }
+            std::string_view rest = pattern.substr(p);
+
+            // "**/" also matches no directory at all
+            if (any_depth && !rest.empty() && rest[0] == '/' && glob_match(rest.substr(1), text.substr(t))) {
+                return true;
+            }
+            for (size_t end = t; end <= text.size(); ++end) {
+                if (glob_match(rest, text.substr(end))) {
+                    return true;
+                }
+                if (end < text.size() && text[end] == '/' && !any_depth) {
+                    return false;
+                }
+            }
+            return false;
+        }
+
+        if (t == text.size()) {
+            return false;
+        }
+
+        if (c == '?') {
+            if (text[t] == '/') {
+                return false;
+            }
+            p++;
+        } else if (c == '[') {
+            size_t pattern_end;
+            bool matched;
+
+            if (text[t] != '/' && match_class(pattern, p + 1, text[t], pattern_end, matched)) {
+                if (!matched) {
+                    return false;
+                }
+                p = pattern_end;
+            } else if (text[t] == '[') {
+                p++;
+            } else {
+                return false;
+            }
+        } else {
+            if (c == '\\' && p + 1 < pattern.size()) {
+                c = pattern[++p];
+            }
+            if (text[t] != c) {
+                return false;
+            }
+            p++;
+        }
+        t++;
+    }
+
+    return t == text.size();
+}
+
+IgnoreRules::IgnoreRules(std::shared_ptr<const IgnoreRules> parent, std::string directory): parent(std::move(parent)), directory(std::move(directory)) {
+    if (this->directory.empty() || this->directory.back() != '/') {
+        this->directory += '/';
+    }
+}
+
+bool IgnoreRules::load(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        add(line);
+    }
+    return true;
+}
+
+void IgnoreRules::add(std::string_view line) {
+    // Trailing whitespace is ignored unless it is escaped
+    while (!line.empty() && (line.back() == ' ' || line.back() == '\r') && !(line.size() > 1 && line[line.size() - 2] == '\\')) {
+        line.remove_suffix(1);
+    }
+    if (line.empty() || line[0] == '#') {
+        return;
+    }
+
+    Pattern pattern { "", false, false, false };
+
+    if (line[0] == '!') {
+        pattern.negated = true;
+        line.remove_prefix(1);
+    } else if (line[0] == '\\') {
+        line.remove_prefix(1);
+    }
+
+    if (!line.empty() && line.back() == '/') {
+        pattern.directory_only = true;
+        line.remove_suffix(1);
+    }
+
+    // A slash anywhere but at the end ties the pattern to this directory
+    pattern.anchored = line.find('/') != std::string_view::npos;
+    if (!line.empty() && line[0] == '/') {
+        line.remove_prefix(1);
+    }
+
+    if (!line.empty()) {
+        pattern.glob = std::string(line);
+        patterns.push_back(std::move(pattern));
+    }
+}
+
+bool IgnoreRules::is_ignored(std::string_view path, bool is_directory) const {
+    std::string_view relative = path.substr(std::min(directory.size(), path.size()));
+    size_t slash = relative.rfind('/');
+    std::string_view name = slash == std::string_view::npos ? relative : relative.substr(slash + 1);
+
+    for (auto it = patterns.rbegin(); it != patterns.rend(); ++it) {
+        if (it->directory_only && !is_directory) {
+            continue;
+        }
+        if (glob_match(it->glob, it->anchored ? relative : name)) {
+            return !it->negated;
+        }
+    }
+
+    return parent != nullptr && parent->is_ignored(path, is_directory);
+}
+
+bool SourceFilter::has_extension(std::string_view name) const {
+    for (const auto& extension: extensions) {
+        if (name.size() > extension.size() && name.compare(name.size() - extension.size(), extension.size(), extension) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::shared_ptr<const IgnoreRules> SourceFilter::directory_rules(const std::string& prefix, std::shared_ptr<const IgnoreRules> parent) const {
+    // Only directories with ignore files of their own get a new rule set
+    auto own_rules = std::make_shared<IgnoreRules>(parent, prefix);
+    for (const auto& ignore_file: ignore_files) {
+        own_rules->load(prefix + ignore_file);
+    }
+    if (own_rules->empty()) {
+        return parent;
+    }
+    return own_rules;
+}
+
+bool SourceFilter::accepts(const std::string& path, bool is_directory, const IgnoreRules* rules) const {
+    size_t slash = path.rfind('/');
+    std::string_view name = slash == std::string::npos ? std::string_view(path) : std::string_view(path).substr(slash + 1);
+
+    if (is_directory ? name == ".git" : !has_extension(name)) {
+        return false;
+    }
+    return rules == nullptr || !rules->is_ignored(path, is_directory);
+}
+
+bool SourceFilter::list(const std::string& prefix, const IgnoreRules* rules, std::vector<std::pair<std::string, bool>>& entries) const {
+    DIR* dir = opendir(prefix.c_str());
+    if (dir == nullptr) {
+        return false;
+    }
+
+    while (dirent* entry = readdir(dir)) {
+        std::string_view name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+
+        unsigned char type = entry->d_type;
+        std::string path = prefix + entry->d_name;
+
+        if (type == DT_UNKNOWN) {
+            struct stat info;
+            if (lstat(path.c_str(), &info) != 0) {
+                continue;
+            }
+            type = S_ISDIR(info.st_mode) ? DT_DIR : S_ISREG(info.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+
+        if ((type == DT_DIR || type == DT_REG) && accepts(path, type == DT_DIR, rules)) {
+            entries.emplace_back(std::move(path), type == DT_DIR);
+        }
+    }
+    closedir(dir);
+
+    // The same order every time, whatever order the file system lists them in
+    std::sort(entries.begin(), entries.end());
+    return true;
+}
+
+// One directory of the walk. Its sorted entries are filled in by the task
+// that reads it; subdirectories get a node of their own, read in parallel.
+struct FileWalker::Directory {
+    struct Entry {
+        std::string path;
+        std::unique_ptr<Directory> directory; // null for a file
+    };
+
+    std::vector<Entry> entries;
+    bool done = false;
+};
+
+FileWalker::FileWalker(size_t threads, size_t queue_size): pool(threads), found(queue_size) {}
+
+FileWalker::~FileWalker() {
+    // Unblocks the driver if it is waiting for room in the queue
+    found.close();
+
+    if (driver.joinable()) {
+        driver.join();
+    }
+}
+
+void FileWalker::start(std::vector<std::string> roots) {
+    driver = std::thread([this, roots = std::move(roots)]() {
+        Directory top;
+        std::vector<std::pair<std::string, bool>> entries;
+
+        for (const auto& root: roots) {
+            entries.emplace_back(root, true);
+        }
+        finish_directory(top, std::move(entries), nullptr);
+
+        // Directories are read in any order, but their files are handed out
+        // depth first from here, so the output never depends on the timing
+        if (!emit(top)) {
+            stopping = true;
+        }
+
+        try {
+            pool.wait();
+        } catch (const std::exception& e) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            walk_errors.push_back(e.what());
+        }
+        found.close();
+    });
+}
+
+std::vector<std::string> FileWalker::errors() {
+    std::lock_guard<std::mutex> lock(error_mutex);
+    return walk_errors;
+}
+
+void FileWalker::submit_walk(Directory& node, std::string directory, std::shared_ptr<const IgnoreRules> rules) {
+    pool.submit([this, &node, directory = std::move(directory), rules = std::move(rules)]() {
+        try {
+            walk_directory(node, directory, rules);
+        } catch (const std::exception& e) {
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                walk_errors.push_back("Cannot read directory: " + directory + " (" + e.what() + ")");
+            }
+            // The driver waits for every directory, so it has to be released
+            finish_directory(node, {}, nullptr);
+        }
+    });
+}
+
+// Publish the entries of a directory and start reading its subdirectories
+void FileWalker::finish_directory(Directory& node, std::vector<std::pair<std::string, bool>> entries, const std::shared_ptr<const IgnoreRules>& rules) {
+    std::vector<Directory::Entry> published;
+    std::vector<std::pair<Directory*, std::string>> subdirectories;
+    published.reserve(entries.size());
+
+    for (auto& [path, is_directory]: entries) {
+        published.push_back({ std::move(path), nullptr });
+
+        if (is_directory) {
+            published.back().directory = std::make_unique<Directory>();
+            subdirectories.emplace_back(published.back().directory.get(), published.back().path);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(tree_mutex);
+        if (node.done) {
+            return;
+        }
+        node.entries = std::move(published);
+        node.done = true;
+    }
+    directory_done.notify_all();
+
+    for (auto& [child, path]: subdirectories) {
+        submit_walk(*child, std::move(path), rules);
+    }
+}
+
+// Hand out the files below node in order, waiting for directories that are
+// still being read. Returns false once the consumer is gone.
+bool FileWalker::emit(Directory& node) {
+    {
+        std::unique_lock<std::mutex> lock(tree_mutex);
+        directory_done.wait(lock, [&node]() { return node.done; });
+    }
+
+    for (auto& entry: node.entries) {
+        if (entry.directory == nullptr) {
+            if (!found.push(std::move(entry.path))) {
+                return false;
+            }
+        } else if (!emit(*entry.directory)) {
+            return false;
+        }
+    }
+
+    // Everything below was read and handed out, so the memory can go
+    node.entries.clear();
+    return true;
+}
+
+void FileWalker::walk_directory(Directory& node, const std::string& directory, std::shared_ptr<const IgnoreRules> rules) {
+    // The consumer is gone, so only release the driver
+    if (stopping) {
+        finish_directory(node, {}, nullptr);
+        return;
+    }
+
+    std::string prefix = directory.back() == '/' ? directory : directory + '/';
+    rules = filter.directory_rules(prefix, std::move(rules));
+
+    // Collect the entries first, so the directory is not held open while blocking
+    std::vector<std::pair<std::string, bool>> entries;
+    if (!filter.list(prefix, rules.get(), entries)) {
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            walk_errors.push_back("Cannot read directory: " + directory + " (" + std::strerror(errno) + ")");
+        }
+        finish_directory(node, {}, nullptr);
+        return;
+    }
+
+    finish_directory(node, std::move(entries), rules);
+}
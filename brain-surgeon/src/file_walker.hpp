@@ -0,0 +1,114 @@
+#pragma once
+
+#include "bounded_queue.hpp"
+#include "thread_pool.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Match a gitignore glob: * and ? stay within a path component, ** spans
+// components, [...] is a character class and \ escapes the next character
+bool glob_match(std::string_view pattern, std::string_view text);
+
+// The patterns of the ignore files of one directory, falling back to those
+// of the parent directories. Later patterns override earlier ones and the
+// patterns of a subdirectory override those of its parents, as in git.
+class IgnoreRules {
+public:
+    IgnoreRules(std::shared_ptr<const IgnoreRules> parent, std::string directory);
+
+    // Add the patterns of an ignore file; returns false if it does not exist
+    bool load(const std::string& filename);
+
+    // Add a single line of an ignore file
+    void add(std::string_view line);
+
+    bool empty() const { return patterns.empty(); }
+
+    // path must lie inside the directory the rules were created for
+    bool is_ignored(std::string_view path, bool is_directory) const;
+
+private:
+    struct Pattern {
+        std::string glob;
+        bool negated;
+        bool directory_only;
+        bool anchored; // matched against the whole relative path, not the name
+    };
+
+    std::shared_ptr<const IgnoreRules> parent;
+    std::string directory; // with a trailing '/'
+    std::vector<Pattern> patterns;
+};
+
+// What the directory walks of lint, fmt and watch treat as source files:
+// regular files with one of the extensions, in directories other than .git,
+// that no ignore file along the way excludes. Symbolic links are not
+// followed, so a walk cannot loop.
+struct SourceFilter {
+    std::vector<std::string> extensions { ".bf", ".b" };
+    std::vector<std::string> ignore_files { ".gitignore", ".bfignore" };
+
+    bool has_extension(std::string_view name) const;
+
+    // The rules for the directory at prefix (with a trailing '/'): those of
+    // its parent, plus its own ignore files if it has any
+    std::shared_ptr<const IgnoreRules> directory_rules(const std::string& prefix, std::shared_ptr<const IgnoreRules> parent) const;
+
+    // Whether a file or directory inside a directory with these rules is walked
+    bool accepts(const std::string& path, bool is_directory, const IgnoreRules* rules) const;
+
+    // The accepted subdirectories (true) and source files (false) directly
+    // inside prefix, sorted. False with errno set if it cannot be read.
+    bool list(const std::string& prefix, const IgnoreRules* rules, std::vector<std::pair<std::string, bool>>& entries) const;
+};
+
+// Walks directory trees on its own threads, one task per directory, and
+// hands out the matching files through a bounded queue while the walk is
+// still going, so the consumer can start right away. Files come out in
+// sorted depth-first order however the directory tasks are scheduled.
+class FileWalker {
+public:
+    static constexpr size_t DEFAULT_QUEUE_SIZE = 1024;
+
+    explicit FileWalker(size_t threads = 0, size_t queue_size = DEFAULT_QUEUE_SIZE);
+    ~FileWalker();
+
+    FileWalker(const FileWalker&) = delete;
+    FileWalker& operator=(const FileWalker&) = delete;
+
+    SourceFilter filter;
+
+    void start(std::vector<std::string> roots);
+
+    // Block until the next file is found; false once the walk is done
+    bool next(std::string& path) { return found.pop(path); }
+
+    // Directories that could not be read
+    std::vector<std::string> errors();
+
+private:
+    struct Directory;
+
+    void submit_walk(Directory& node, std::string directory, std::shared_ptr<const IgnoreRules> rules);
+    void walk_directory(Directory& node, const std::string& directory, std::shared_ptr<const IgnoreRules> rules);
+    void finish_directory(Directory& node, std::vector<std::pair<std::string, bool>> entries, const std::shared_ptr<const IgnoreRules>& rules);
+    bool emit(Directory& node);
+
+    ThreadPool pool;
+    BoundedQueue<std::string> found;
+    std::thread driver;
+
+    // Guards the entries of directories that are still being read
+    std::mutex tree_mutex;
+    std::condition_variable directory_done;
+    std::atomic<bool> stopping { false };
+
+    std::mutex error_mutex;
+    std::vector<std::string> walk_errors;
+};
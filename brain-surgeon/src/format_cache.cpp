@@ -0,0 +1,55 @@
+#include "format_cache.hpp"
+
+static constexpr uint64_t FNV_OFFSET = 14695981039346656037ull;
+static constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+static uint64_t mix(uint64_t hash, const void* data, size_t size) {
+    const auto* bytes = static_cast<const unsigned char*>(data);
+
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+template <typename T>
+static uint64_t mix_value(uint64_t hash, const T& value) {
+    return mix(hash, &value, sizeof(value));
+}
+
+const std::string* FormatCache::find(const SubtreeKey& key) const {
+    auto it = entries.find(key);
+    return it == entries.end() ? nullptr : &it->second;
+}
+
+void FormatCache::insert(const SubtreeKey& key, std::string_view text) {
+    if (text.size() > max_bytes) {
+        return;
+    }
+
+    // Start over rather than tracking recency; unchanged loops of the
+    // documents being edited come back on the next format
+    if (stored_bytes + text.size() > max_bytes) {
+        clear();
+    }
+
+    auto inserted = entries.emplace(key, std::string(text));
+    if (inserted.second) {
+        stored_bytes += text.size();
+    }
+}
+
+void FormatCache::clear() {
+    entries.clear();
+    stored_bytes = 0;
+}
+
+uint64_t config_fingerprint(const FormatterConfig& config) {
+    uint64_t hash = FNV_OFFSET;
+    bool flags[] = { config.space_between_groups, config.comment_on_newline, config.loop_on_newline, config.move_on_newline, config.end_line_at_io, config.tally_commands, config.tab_indent };
+
+    hash = mix(hash, flags, sizeof(flags));
+    hash = mix_value(hash, config.indent_spaces);
+    hash = mix_value(hash, config.comment_prefix.size());
+    return mix(hash, config.comment_prefix.data(), config.comment_prefix.size());
+}
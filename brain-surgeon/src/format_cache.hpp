@@ -0,0 +1,52 @@
+#pragma once
+
+#include "formatter_config.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Identifies the rendered text of a loop: its structure as hashed by the parser
+// (whitespace does not affect formatting), the indentation level and the
+// formatter configuration
+struct SubtreeKey {
+    uint64_t hash;
+    size_t node_count;
+    int indent_level;
+    uint64_t config_fingerprint;
+
+    bool operator==(const SubtreeKey& other) const {
+        return hash == other.hash && node_count == other.node_count && indent_level == other.indent_level && config_fingerprint == other.config_fingerprint;
+    }
+};
+
+struct SubtreeKeyHash {
+    size_t operator()(const SubtreeKey& key) const {
+        return static_cast<size_t>(key.hash ^ (key.config_fingerprint * 31) ^ (static_cast<uint64_t>(key.indent_level) << 48));
+    }
+};
+
+// Rendered loops kept across format_tree calls, so reformatting a mostly
+// unchanged document splices in the text of every unchanged loop instead of
+// formatting it again. Not thread-safe; use one cache per thread.
+class FormatCache {
+public:
+    // Loops smaller than this are cheaper to format than to look up
+    static constexpr size_t MIN_CACHED_NODES = 16;
+
+    explicit FormatCache(size_t max_bytes = 64 * 1024 * 1024): max_bytes(max_bytes) {}
+
+    const std::string* find(const SubtreeKey& key) const;
+    void insert(const SubtreeKey& key, std::string_view text);
+    void clear();
+
+    size_t hits = 0;
+    size_t misses = 0;
+
+private:
+    std::unordered_map<SubtreeKey, std::string, SubtreeKeyHash> entries;
+    size_t max_bytes;
+    size_t stored_bytes = 0;
+};
+
+uint64_t config_fingerprint(const FormatterConfig& config);
@@ -1,221 +1,292 @@
-#include "formatter_config.hpp"
-#include "parser.hpp"
-#include <sstream>
+#include "formatter.hpp"
+#include "brainfuck_formatter.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
 #include <string>
+#include <unistd.h>
 
-class BrainfuckFormatter {
-private:
-    const FormatterConfig& config;
-    std::ostringstream output;
-    int current_indent_level = 0;
-
-    // Convert command token to its character representation
-    std::string command_to_string(TokenType type) const {
-        switch (type) {
-            case TokenType::MOVE_RIGHT: return ">";
-            case TokenType::MOVE_LEFT: return "<";
-            case TokenType::INCREMENT: return "+";
-            case TokenType::DECREMENT: return "-";
-            case TokenType::OUTPUT: return ".";
-            case TokenType::INPUT: return ",";
-            default: return "";
+void format_tree(const ProgramNode* root, const FormatterConfig& config, OutputBuffer& output) {
+    BrainfuckFormatter formatter(config, output);
+    formatter.format(root);
+}
+
+void format_tree(const ProgramNode* root, const FormatterConfig& config, OutputBuffer& output, const CancellationToken& cancel) {
+    BrainfuckFormatter formatter(config, output);
+    formatter.set_cancellation(&cancel);
+    formatter.format(root);
+}
+
+// The formatter flushes everything before and after a top-level loop or
+// unmatched ']', so formatting starts from a clean state on either side of one
+static bool is_segment_break(const ASTNode* node) {
+    return node->type == NodeType::LOOP || node->type == NodeType::UNMATCHED_CLOSE;
+}
+
+void format_tree_parallel(const ProgramNode* root, const FormatterConfig& config, OutputBuffer& output, ThreadPool& pool) {
+    if (root == nullptr || root->statements.empty()) {
+        return;
+    }
+
+    const auto& stmts = root->statements;
+
+    // Cut the statements into a few batches per worker, only at segment
+    // breaks; batches are handed out dynamically to balance uneven loops
+    size_t batch_target = std::max<size_t>(1, stmts.size() / (pool.size() * 8));
+    std::vector<size_t> cuts { 0 };
+
+    for (size_t i = 1; i < stmts.size(); ++i) {
+        bool at_break = is_segment_break(stmts[i].get()) || is_segment_break(stmts[i - 1].get());
+
+        if (at_break && i - cuts.back() >= batch_target) {
+            cuts.push_back(i);
         }
     }
+    cuts.push_back(stmts.size());
+
+    std::vector<std::string> batches(cuts.size() - 1);
 
-    // Check if two commands are in the same group (same operation type)
-    bool are_same_group(TokenType a, TokenType b) const {
-        // Movement group: < and >
-        if ((a == TokenType::MOVE_LEFT || a == TokenType::MOVE_RIGHT) && (b == TokenType::MOVE_LEFT || b == TokenType::MOVE_RIGHT)) {
-            return true;
+    parallel_for(pool, batches.size(), [&](size_t b) {
+        OutputBuffer batch_output;
+        BrainfuckFormatter formatter(config, batch_output);
+
+        for (size_t i = cuts[b]; i < cuts[b + 1]; ++i) {
+            formatter.format_statement(stmts[i].get());
         }
-        // Increment/decrement group: + and -
-        if ((a == TokenType::INCREMENT || a == TokenType::DECREMENT) && (b == TokenType::INCREMENT || b == TokenType::DECREMENT)) {
-            return true;
+        formatter.finish();
+
+        batches[b] = batch_output.take();
+    });
+
+    for (const auto& batch: batches) {
+        output.write(batch);
+        output.maybe_flush();
+    }
+    output.flush();
+}
+
+// Last line covered by a statement. Unterminated loops keep the position of
+// their '[' but run until the end of the input.
+static size_t statement_last_line(const ASTNode* node) {
+    while (node->type == NodeType::LOOP) {
+        const auto* loop = static_cast<const LoopNode*>(node);
+
+        if (loop->is_terminated || loop->body.empty()) {
+            break;
         }
-        // Same exact command
-        return a == b;
+        node = loop->body.back().get();
     }
+    return node->end_line;
+}
 
-    // Check if command is a movement command
-    bool is_movement_command(TokenType type) const {
-        return type == TokenType::MOVE_LEFT || type == TokenType::MOVE_RIGHT;
+FormattedRange format_range(const ProgramNode* root, const FormatterConfig& config, size_t start_line, size_t end_line) {
+    if (root == nullptr || root->statements.empty()) {
+        throw std::out_of_range("Cannot format a range of an empty program");
     }
 
-    // Check if command is an I/O command
-    bool is_io_command(TokenType type) const {
-        return type == TokenType::INPUT || type == TokenType::OUTPUT;
+    const auto& stmts = root->statements;
+    auto last_line = [&](size_t i) { return statement_last_line(stmts[i].get()); };
+
+    // Top-level statements are ordered, so both ends of the overlap are found
+    // by binary search
+    auto first = std::partition_point(stmts.begin(), stmts.end(), [&](const auto& stmt) { return statement_last_line(stmt.get()) < start_line; });
+    auto past_last = std::partition_point(first, stmts.end(), [&](const auto& stmt) { return stmt->start_line <= end_line; });
+
+    if (first == stmts.end() || first == past_last) {
+        throw std::out_of_range("Range is outside of the program");
     }
 
-    // Generate indentation string
-    std::string get_indent() const {
-        if (config.tab_indent) {
-            return std::string(current_indent_level, '\t');
-        } else {
-            return std::string(current_indent_level * config.indent_spaces, ' ');
-        }
+    size_t lo = static_cast<size_t>(first - stmts.begin());
+    size_t hi = static_cast<size_t>(past_last - stmts.begin()) - 1;
+
+    // Widen to whole lines, so the replacement never splits a line
+    while (lo > 0 && last_line(lo - 1) >= stmts[lo]->start_line) {
+        lo--;
+    }
+    while (hi + 1 < stmts.size() && stmts[hi + 1]->start_line <= last_line(hi)) {
+        hi++;
     }
 
-    // Add spacing between character groups with tally marks
-    std::string format_command_group(const std::string& commands) const {
-        if (!config.tally_commands || commands.length() <= 5) {
-            return commands;
-        }
+    FormattedRange result { stmts[lo]->start_line, last_line(hi), "" };
+    OutputBuffer output;
+    BrainfuckFormatter formatter(config, output);
 
-        std::string result;
-        for (size_t i = 0; i < commands.length(); ++i) {
-            if (i > 0 && i % 5 == 0) {
-                result += ' ';
-            }
-            result += commands[i];
+    for (size_t i = lo; i <= hi; ++i) {
+        formatter.format_statement(stmts[i].get());
+    }
+    formatter.finish();
+
+    result.text = output.take();
+    return result;
+}
+
+FormattedRange format_range(const ProgramNode* root, const FormatterConfig& config, const LineIndex& lines, size_t start_offset, size_t end_offset) {
+    size_t last_offset = end_offset > start_offset ? end_offset - 1 : start_offset;
+    return format_range(root, config, lines.line_of(start_offset), lines.line_of(last_offset));
+}
+
+TextEdit range_edit(const FormattedRange& range, const LineIndex& lines) {
+    return { lines.line_start(range.start_line), lines.line_start(range.end_line + 1), range.text };
+}
+
+static bool is_command_char(char c) {
+    switch (c) {
+        case '>':
+        case '<':
+        case '+':
+        case '-':
+        case '.':
+        case ',':
+        case '[':
+        case ']': return true;
+        default: return false;
+    }
+}
+
+static size_t next_command(std::string_view text, size_t position) {
+    while (position < text.size() && !is_command_char(text[position])) {
+        position++;
+    }
+    return position;
+}
+
+// Replace original[start, end) by formatted[out_start, out_end), leaving out
+// what both gaps have in common at either end
+static void add_gap_edit(std::vector<TextEdit>& edits, std::string_view original, size_t start, size_t end, std::string_view formatted, size_t out_start, size_t out_end) {
+    while (start < end && out_start < out_end && original[start] == formatted[out_start]) {
+        start++;
+        out_start++;
+    }
+    while (start < end && out_start < out_end && original[end - 1] == formatted[out_end - 1]) {
+        end--;
+        out_end--;
+    }
+
+    if (start < end || out_start < out_end) {
+        edits.push_back({ start, end, std::string(formatted.substr(out_start, out_end - out_start)) });
+    }
+}
+
+std::vector<TextEdit> formatting_edits(std::string_view original, std::string_view formatted) {
+    std::vector<TextEdit> edits;
+    size_t gap_start = 0;
+    size_t out_gap_start = 0;
+
+    while (true) {
+        size_t command = next_command(original, gap_start);
+        size_t out_command = next_command(formatted, out_gap_start);
+
+        // Unterminated loops are closed in the output, so the commands stop
+        // matching at the very end; everything left is a single edit
+        if (command == original.size() || out_command == formatted.size() || original[command] != formatted[out_command]) {
+            add_gap_edit(edits, original, gap_start, original.size(), formatted, out_gap_start, formatted.size());
+            break;
         }
-        return result;
-    }
-
-    // Format a sequence of statements
-    void format_statements(const std::vector<std::unique_ptr<ASTNode>>& statements) {
-        std::string current_line = get_indent();
-        std::string command_buffer;
-        TokenType last_command_type = TokenType::WHITESPACE;
-        bool line_has_content = false;
-        std::string pending_comment;
-
-        auto flush_command_buffer = [&]() {
-            if (!command_buffer.empty()) {
-                if (line_has_content && config.space_between_groups) {
-                    current_line += " ";
-                }
-                current_line += format_command_group(command_buffer);
-                command_buffer.clear();
-                line_has_content = true;
-            }
-        };
 
-        auto flush_current_line = [&]() {
-            flush_command_buffer();
-            if (line_has_content) {
-                output << current_line << "\n";
-            }
-            current_line = get_indent();
-            line_has_content = false;
-        };
-
-        auto flush_pending_comment = [&]() {
-            if (!pending_comment.empty()) {
-                if (config.comment_on_newline && line_has_content) {
-                    flush_current_line();
-                }
-
-                // Check if comment already starts with prefix
-                std::string final_comment;
-                if (!config.comment_prefix.empty() && pending_comment.length() >= config.comment_prefix.length() && pending_comment.substr(0, config.comment_prefix.length()) == config.comment_prefix)
-                {
-                    // Comment already has prefix, use as-is
-                    final_comment = pending_comment;
-                } else {
-                    // Comment doesn't have prefix, prepend it
-                    final_comment = config.comment_prefix + pending_comment;
-                }
-
-                output << get_indent() << final_comment << "\n";
-                pending_comment.clear();
+        add_gap_edit(edits, original, gap_start, command, formatted, out_gap_start, out_command);
+        gap_start = command + 1;
+        out_gap_start = out_command + 1;
+    }
+
+    return edits;
+}
+
+void format_stream(int input_fd, const FormatterConfig& config, OutputBuffer& output) {
+    BrainfuckFormatter formatter(config, output);
+    format_tokens(input_fd, formatter);
+    output.flush();
+}
+
+// Reads the original file chunk by chunk, just ahead of the formatter output
+// it is compared with, and remembers the first byte that differs
+class OriginalComparer {
+public:
+    explicit OriginalComparer(int fd): original(fd), buffer(OutputBuffer::DEFAULT_CHUNK_SIZE) {}
+
+    bool compare(std::string_view chunk) {
+        while (!chunk.empty()) {
+            if (position == end && !fill()) {
+                mismatch = true;
+                return false;
             }
-        };
-
-        for (const auto& stmt: statements) {
-            switch (stmt->type) {
-                case NodeType::COMMAND: {
-                    flush_pending_comment();
-
-                    const auto* cmd = static_cast<const CommandNode*>(stmt.get());
-                    std::string cmd_char = command_to_string(cmd->command);
-
-                    // Check if we need to start a new command group
-                    if (!command_buffer.empty() && !are_same_group(last_command_type, cmd->command)) {
-                        flush_command_buffer();
-                    }
-
-                    // Handle newline BEFORE movement groups
-                    if (is_movement_command(cmd->command) && config.move_on_newline && command_buffer.empty() && line_has_content) {
-                        flush_current_line();
-                    }
-
-                    // Add command to buffer
-                    command_buffer += cmd_char;
-                    last_command_type = cmd->command;
-
-                    // Handle newline after I/O commands
-                    if (is_io_command(cmd->command) && config.end_line_at_io) {
-                        flush_current_line();
-                    }
-                    break;
-                }
-
-                case NodeType::LOOP: {
-                    flush_pending_comment();
-                    flush_current_line();
-
-                    const auto* loop = static_cast<const LoopNode*>(stmt.get());
-
-                    if (config.loop_on_newline) {
-                        output << get_indent() << "[\n";
-                        current_indent_level++;
-                        format_statements(loop->body);
-                        current_indent_level--;
-                        output << get_indent() << "]\n";
-                    } else {
-                        output << get_indent() << "[";
-                        current_indent_level++;
-                        format_statements(loop->body);
-                        current_indent_level--;
-                        output << "]\n";
-                    }
-                    break;
-                }
-
-                case NodeType::COMMENT: {
-                    const auto* comment = static_cast<const CommentNode*>(stmt.get());
-
-                    if (!pending_comment.empty()) {
-                        pending_comment += " ";
-                    }
-                    pending_comment += comment->text;
-                    break;
-                }
-
-                case NodeType::UNMATCHED_CLOSE: {
-                    flush_pending_comment();
-                    flush_current_line();
-                    output << get_indent() << "]\n";
-                    break;
-                }
-
-                default: break;
+
+            size_t count = std::min(chunk.size(), end - position);
+            auto differs = std::mismatch(chunk.begin(), chunk.begin() + count, buffer.begin() + position);
+            size_t same = static_cast<size_t>(differs.first - chunk.begin());
+
+            count_lines(chunk.substr(0, same));
+            if (same < count) {
+                mismatch = true;
+                return false;
             }
-        }
 
-        // Flush any remaining content
-        flush_pending_comment();
-        flush_current_line();
+            chunk.remove_prefix(count);
+            position += count;
+        }
+        return true;
     }
 
-public:
-    explicit BrainfuckFormatter(const FormatterConfig& cfg): config(cfg) {}
+    // The original may continue after the formatter output ended
+    bool has_more() { return position < end || fill(); }
 
-    std::string format(const ProgramNode* program) {
-        output.str("");
-        output.clear();
-        current_indent_level = 0;
+    bool mismatch = false;
+    size_t offset = 0;
+    size_t line = 1;
 
-        if (program != nullptr && !program->statements.empty()) {
-            format_statements(program->statements);
+private:
+    bool fill() {
+        ssize_t count;
+        do {
+            count = ::read(original, buffer.data(), buffer.size());
+        } while (count < 0 && errno == EINTR);
+
+        if (count < 0) {
+            throw std::runtime_error(std::string("Cannot read input: ") + std::strerror(errno));
         }
+        position = 0;
+        end = static_cast<size_t>(count);
+        return count > 0;
+    }
 
-        return output.str();
+    void count_lines(std::string_view matched) {
+        offset += matched.size();
+        line += static_cast<size_t>(std::count(matched.begin(), matched.end(), '\n'));
     }
+
+    int original;
+    std::vector<char> buffer;
+    size_t position = 0;
+    size_t end = 0;
 };
 
+FormatCheck check_format(int input_fd, int original_fd, const FormatterConfig& config) {
+    OriginalComparer comparer(original_fd);
+
+    // Small chunks, so that a difference near the start stops formatting early
+    OutputBuffer output([&](std::string_view chunk) { return comparer.compare(chunk); }, 4096);
+    format_stream(input_fd, config, output);
+
+    if (!comparer.mismatch && comparer.has_more()) {
+        comparer.mismatch = true;
+    }
+    return { !comparer.mismatch, comparer.offset, comparer.line };
+}
+
+void format_tree(const ProgramNode* root, const FormatterConfig& config, OutputBuffer& output, FormatCache& cache) {
+    BrainfuckFormatter formatter(config, output, &cache);
+    formatter.format(root);
+}
+
 // Public interface function
-std::string format_tree(const ProgramNode* root, const FormatterConfig& config = FormatterConfig {}) {
-    BrainfuckFormatter formatter(config);
-    return formatter.format(root);
+std::string format_tree(const ProgramNode* root, const FormatterConfig& config) {
+    OutputBuffer output;
+    format_tree(root, config, output);
+    return output.take();
+}
+
+std::string format_tree(const ProgramNode* root, const FormatterConfig& config, FormatCache& cache) {
+    OutputBuffer output;
+    format_tree(root, config, output, cache);
+    return output.take();
 }
@@ -1,7 +1,65 @@
 #pragma once
 
+#include "cancellation.hpp"
+#include "format_cache.hpp"
 #include "formatter_config.hpp"
+#include "output_buffer.hpp"
 #include "parser.hpp"
+#include "source.hpp"
+#include "thread_pool.hpp"
 #include <string>
+#include <string_view>
+#include <vector>
 
 std::string format_tree(const ProgramNode* root, const FormatterConfig& config);
+
+// Format straight into a (presized or file descriptor backed) output buffer
+void format_tree(const ProgramNode* root, const FormatterConfig& config, OutputBuffer& output);
+
+// Throws OperationCancelled soon after cancel is cancelled
+void format_tree(const ProgramNode* root, const FormatterConfig& config, OutputBuffer& output, const CancellationToken& cancel);
+
+// Reuse the rendered text of loops that are unchanged since an earlier call
+std::string format_tree(const ProgramNode* root, const FormatterConfig& config, FormatCache& cache);
+void format_tree(const ProgramNode* root, const FormatterConfig& config, OutputBuffer& output, FormatCache& cache);
+
+// Format runs of top-level statements between loops on the pool and join them
+// in order; the result is byte-identical to format_tree
+void format_tree_parallel(const ProgramNode* root, const FormatterConfig& config, OutputBuffer& output, ThreadPool& pool);
+
+// Format the program read from input_fd token by token, without building an
+// AST. Memory stays bounded by the nesting depth and the longest comment.
+void format_stream(int input_fd, const FormatterConfig& config, OutputBuffer& output);
+
+// Formatted replacement for the whole lines [start_line, end_line]
+struct FormattedRange {
+    size_t start_line;
+    size_t end_line;
+    std::string text;
+};
+
+// Format only the top-level statements overlapping the given lines (or byte
+// offsets), widened to whole statements and lines. The work done is
+// proportional to the size of the range, not of the program.
+FormattedRange format_range(const ProgramNode* root, const FormatterConfig& config, size_t start_line, size_t end_line);
+FormattedRange format_range(const ProgramNode* root, const FormatterConfig& config, const LineIndex& lines, size_t start_offset, size_t end_offset);
+
+// The exact byte span of the source replaced by a formatted range
+TextEdit range_edit(const FormattedRange& range, const LineIndex& lines);
+
+struct FormatCheck {
+    bool is_formatted;
+    size_t offset; // first byte that differs from the formatted output
+    size_t line;   // line of that byte
+};
+
+// Compare the formatted program read from input_fd with the original read
+// from original_fd (a second descriptor of the same file) while formatting,
+// stopping at the first difference and never holding the whole output
+FormatCheck check_format(int input_fd, int original_fd, const FormatterConfig& config);
+
+// Minimal edits that turn the original source into its formatted text.
+// Formatting keeps every command in place relative to the others, so both
+// texts are walked once in parallel, aligned on their commands, and only the
+// whitespace and comments between two commands that changed become an edit.
+std::vector<TextEdit> formatting_edits(std::string_view original, std::string_view formatted);
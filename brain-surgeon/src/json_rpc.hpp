@@ -0,0 +1,31 @@
+#pragma once
+
+#include "../include/json.hpp"
+#include <stdexcept>
+#include <string>
+
+using json = nlohmann::json;
+
+// JSON-RPC error codes
+constexpr int PARSE_ERROR = -32700;
+constexpr int INVALID_REQUEST = -32600;
+constexpr int METHOD_NOT_FOUND = -32601;
+constexpr int INVALID_PARAMS = -32602;
+constexpr int INTERNAL_ERROR = -32603;
+constexpr int CONTENT_MODIFIED = -32801; // the document changed while the request was pending
+
+// Thrown by a method handler to answer with a specific error code
+class RpcError: public std::runtime_error {
+public:
+    RpcError(int code, const std::string& message): std::runtime_error(message), code(code) {}
+
+    int code;
+};
+
+inline json rpc_result(const json& id, json result) {
+    return { { "jsonrpc", "2.0" }, { "id", id }, { "result", std::move(result) } };
+}
+
+inline json rpc_error(const json& id, int code, const std::string& message) {
+    return { { "jsonrpc", "2.0" }, { "id", id }, { "error", { { "code", code }, { "message", message } } } };
+}
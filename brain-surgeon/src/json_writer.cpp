@@ -0,0 +1,124 @@
+#include "json_writer.hpp"
+#include <charconv>
+
+void append_json_string(std::string& out, std::string_view text) {
+    static const char hex_digits[] = "0123456789abcdef";
+
+    out += '"';
+
+    for (char c: text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default: {
+                auto byte = static_cast<unsigned char>(c);
+
+                if (byte < 0x20) {
+                    out += "\\u00";
+                    out += hex_digits[byte >> 4];
+                    out += hex_digits[byte & 0xf];
+                } else {
+                    out += c;
+                }
+                break;
+            }
+        }
+    }
+
+    out += '"';
+}
+
+void append_json_number(std::string& out, size_t value) {
+    char buffer[24];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, result.ptr);
+}
+
+void append_diagnostic_json(std::string& out, const LintDiagnostic& diagnostic) {
+    out += "{\"endColumn\":";
+    append_json_number(out, diagnostic.end_column);
+    out += ",\"endLine\":";
+    append_json_number(out, diagnostic.end_line);
+    out += ",\"level\":";
+    append_json_string(out, level_to_string(diagnostic.severity));
+    out += ",\"message\":";
+    append_json_string(out, diagnostic.message);
+    out += ",\"startColumn\":";
+    append_json_number(out, diagnostic.start_column);
+    out += ",\"startLine\":";
+    append_json_number(out, diagnostic.start_line);
+    out += '}';
+}
+
+// Keys are written column first, in the same sorted order as diagnostics
+static void append_position_json(std::string& out, const char* column_key, const char* line_key, size_t offset, const LineIndex& lines) {
+    size_t line = lines.line_of(offset);
+
+    out += column_key;
+    append_json_number(out, offset - lines.line_start(line) + 1);
+    out += line_key;
+    append_json_number(out, line);
+}
+
+void append_edit_json(std::string& out, const TextEdit& edit, const LineIndex& lines) {
+    append_position_json(out, "{\"endColumn\":", ",\"endLine\":", edit.end_offset, lines);
+    out += ",\"newText\":";
+    append_json_string(out, edit.replacement);
+    append_position_json(out, ",\"startColumn\":", ",\"startLine\":", edit.start_offset, lines);
+    out += '}';
+}
+
+void write_edits_json(std::ostream& out, const std::vector<TextEdit>& edits, const LineIndex& lines) {
+    std::string text = "[";
+
+    for (size_t i = 0; i < edits.size(); ++i) {
+        if (i > 0) {
+            text += ',';
+        }
+        append_edit_json(text, edits[i], lines);
+    }
+    text += ']';
+
+    out.write(text.data(), static_cast<std::streamsize>(text.size()));
+}
+
+void DiagnosticWriter::begin() {
+    first = true;
+
+    if (format == DiagnosticFormat::ARRAY) {
+        out << '[';
+    }
+}
+
+void DiagnosticWriter::write(const LintDiagnostic& diagnostic) {
+    scratch.clear();
+
+    if (format == DiagnosticFormat::ARRAY && !first) {
+        scratch += ',';
+    }
+    append_diagnostic_json(scratch, diagnostic);
+
+    if (format == DiagnosticFormat::NDJSON) {
+        scratch += '\n';
+    }
+    out.write(scratch.data(), static_cast<std::streamsize>(scratch.size()));
+
+    // Each NDJSON line is made visible right away, while linting continues
+    if (format == DiagnosticFormat::NDJSON) {
+        out.flush();
+    }
+
+    first = false;
+}
+
+void DiagnosticWriter::end() {
+    if (format == DiagnosticFormat::ARRAY) {
+        out << ']';
+    }
+    out.flush();
+}
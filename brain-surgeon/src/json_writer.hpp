@@ -0,0 +1,42 @@
+#pragma once
+
+#include "linter.hpp"
+#include "source.hpp"
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Append a quoted JSON string, escaped the same way as nlohmann::json::dump()
+void append_json_string(std::string& out, std::string_view text);
+
+// Append an unsigned JSON number
+void append_json_number(std::string& out, size_t value);
+
+// Append a diagnostic as a compact JSON object with the keys in dump() order
+void append_diagnostic_json(std::string& out, const LintDiagnostic& diagnostic);
+
+// Append a text edit with 1-based line/column positions of the source; the
+// end position is exclusive so that insertions have an empty range
+void append_edit_json(std::string& out, const TextEdit& edit, const LineIndex& lines);
+
+// Write edits as a JSON array
+void write_edits_json(std::ostream& out, const std::vector<TextEdit>& edits, const LineIndex& lines);
+
+// Writes diagnostics to a stream as they are produced, without building a DOM.
+// ARRAY output is byte-compatible with the old nlohmann based lint_to_json(),
+// NDJSON writes one object per line and flushes it immediately.
+class DiagnosticWriter {
+public:
+    explicit DiagnosticWriter(std::ostream& out, DiagnosticFormat format = DiagnosticFormat::ARRAY): out(out), format(format) {}
+
+    void begin();
+    void write(const LintDiagnostic& diagnostic);
+    void end();
+
+private:
+    std::ostream& out;
+    DiagnosticFormat format;
+    bool first = true;
+    std::string scratch; // reused per diagnostic to avoid reallocating
+};
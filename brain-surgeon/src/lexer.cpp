@@ -1,37 +1,73 @@
 #include "lexer.hpp"
-#include <string.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
 
-std::vector<Token> BrainfuckLexer::tokenize(const std::string& input) {
+// Everything that is not a command, whitespace or a newline belongs to a comment
+static bool is_comment_char(char c) {
+    switch (c) {
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\r':
+        case '>':
+        case '<':
+        case '+':
+        case '-':
+        case '.':
+        case ',':
+        case '[':
+        case ']': return false;
+        default: return true;
+    }
+}
+
+static TokenType classify(char c) {
+    switch (c) {
+        case ',': return TokenType::INPUT;
+        case '.': return TokenType::OUTPUT;
+        case '+': return TokenType::INCREMENT;
+        case '-': return TokenType::DECREMENT;
+        case '<': return TokenType::MOVE_LEFT;
+        case '>': return TokenType::MOVE_RIGHT;
+        case '[': return TokenType::LOOP_START;
+        case ']': return TokenType::LOOP_END;
+        case ' ':
+        case '\t':
+        case '\r': return TokenType::WHITESPACE;
+        case '\n': return TokenType::NEWLINE;
+        default: return TokenType::COMMENT;
+    }
+}
+
+std::vector<Token> BrainfuckLexer::tokenize(std::string_view input) {
+    std::vector<Token> tokens;
+    tokenize(input, tokens);
+    return tokens;
+}
+
+void BrainfuckLexer::tokenize(std::string_view input, std::vector<Token>& tokens) {
     size_t index = 0;
     size_t start_line = 1;
     size_t start_column = 1;
-    std::vector<Token> tokens;
+
+    tokens.clear();
 
     while (index < input.length()) {
-        TokenType type;
+        TokenType type = classify(input[index]);
         std::string text;
         bool is_valid = true;
         size_t end_line = start_line;
         size_t end_column = start_line;
 
-        switch (input[index]) {
-            case ',': type = TokenType::INPUT; break;
-            case '.': type = TokenType::OUTPUT; break;
-            case '+': type = TokenType::INCREMENT; break;
-            case '-': type = TokenType::DECREMENT; break;
-            case '<': type = TokenType::MOVE_LEFT; break;
-            case '>': type = TokenType::MOVE_RIGHT; break;
-            case '[': type = TokenType::LOOP_START; break;
-            case ']': type = TokenType::LOOP_END; break;
-            case ' ':
-            case '\t':
+        switch (type) {
+            case TokenType::WHITESPACE:
                 is_valid = false;
-                type = TokenType::WHITESPACE;
 
                 break;
-            case '\n':
+            case TokenType::NEWLINE:
                 is_valid = false;
-                type = TokenType::NEWLINE;
 
                 tokens.push_back({ type, is_valid, start_line, start_column, end_line, end_column, text });
 
@@ -40,18 +76,13 @@ std::vector<Token> BrainfuckLexer::tokenize(const std::string& input) {
                 start_column = 1;
 
                 continue;
-            default: {
+            case TokenType::COMMENT: {
                 is_valid = false;
-                type = TokenType::COMMENT;
 
                 size_t comment_start_index = index;
                 size_t comment_start_column = start_column;
 
-                while (index < input.length()) {
-                    if (strchr(" \t\n\r><+-.,[]", input[index]) != nullptr) {
-                        break;
-                    }
-
+                while (index < input.length() && is_comment_char(input[index])) {
                     index++;
                     start_column++;
                 }
@@ -61,6 +92,7 @@ std::vector<Token> BrainfuckLexer::tokenize(const std::string& input) {
 
                 continue;
             }
+            default: break;
         }
 
         tokens.push_back({ type, is_valid, start_line, start_column, end_line, start_column, text });
@@ -68,6 +100,77 @@ std::vector<Token> BrainfuckLexer::tokenize(const std::string& input) {
         index++;
         start_column++;
     }
+}
 
-    return tokens;
+ChunkedLexer::ChunkedLexer(int fd, size_t chunk_size): fd(fd), buffer(chunk_size) {}
+
+bool ChunkedLexer::fill() {
+    if (eof) {
+        return false;
+    }
+
+    ssize_t count;
+    do {
+        count = ::read(fd, buffer.data(), buffer.size());
+    } while (count < 0 && errno == EINTR);
+
+    if (count < 0) {
+        throw std::runtime_error(std::string("Cannot read input: ") + std::strerror(errno));
+    }
+
+    position = 0;
+    end = static_cast<size_t>(count);
+    eof = (count == 0);
+    total_read += end;
+
+    return !eof;
+}
+
+bool ChunkedLexer::next(Token& token) {
+    if (position == end && !fill()) {
+        return false;
+    }
+
+    TokenType type = classify(buffer[position]);
+
+    token.type = type;
+    token.is_valid = (type != TokenType::WHITESPACE && type != TokenType::NEWLINE && type != TokenType::COMMENT);
+    token.start_line = line;
+    token.start_column = column;
+    token.end_line = line;
+    token.text.clear();
+
+    if (type == TokenType::COMMENT) {
+        // A comment may continue past the end of the current chunk
+        while (position < end || fill()) {
+            size_t run_end = position;
+            while (run_end < end && is_comment_char(buffer[run_end])) {
+                run_end++;
+            }
+
+            token.text.append(buffer.data() + position, run_end - position);
+            column += run_end - position;
+            position = run_end;
+
+            if (position < end) {
+                break;
+            }
+        }
+
+        token.end_column = column - 1;
+        return true;
+    }
+
+    position++;
+
+    if (type == TokenType::NEWLINE) {
+        token.end_column = line; // matches tokenize()
+        line++;
+        column = 1;
+    } else {
+        token.end_column = column;
+        column++;
+    }
+
+    return true;
 }
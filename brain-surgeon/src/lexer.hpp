@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 enum class TokenType {
@@ -29,5 +30,32 @@ struct Token {
 
 class BrainfuckLexer {
 public:
-    std::vector<Token> tokenize(const std::string& input);
+    std::vector<Token> tokenize(std::string_view input);
+
+    // Tokenize into an existing vector, reusing its memory
+    void tokenize(std::string_view input, std::vector<Token>& tokens);
+};
+
+// Produces the same tokens as BrainfuckLexer::tokenize() while reading the
+// input in fixed-size chunks, so memory does not depend on the input size
+class ChunkedLexer {
+public:
+    explicit ChunkedLexer(int fd, size_t chunk_size = 64 * 1024);
+
+    // Read the next token, returns false at the end of the input
+    bool next(Token& token);
+
+    size_t bytes_read() const { return total_read; }
+
+private:
+    bool fill();
+
+    int fd;
+    std::vector<char> buffer;
+    size_t position = 0;
+    size_t end = 0;
+    bool eof = false;
+    size_t total_read = 0;
+    size_t line = 1;
+    size_t column = 1;
 };
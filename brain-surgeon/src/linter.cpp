@@ -1,15 +1,13 @@
 #include "linter.hpp"
-#include "../include/json.hpp"
+#include "json_writer.hpp"
 #include "parser.hpp"
+#include <algorithm>
+#include <sstream>
 #include <vector>
 
-using json = nlohmann::json;
-
-std::vector<LintDiagnostic> lint_tree(const ASTNode* node) {
-    std::vector<LintDiagnostic> diagnostics;
-
+void lint_tree(const ASTNode* node, const LintCallback& emit, const CancellationToken* cancel) {
     if (node == nullptr) {
-        return diagnostics;
+        return;
     }
 
     if (node->type == NodeType::PROGRAM) {
@@ -17,19 +15,29 @@ std::vector<LintDiagnostic> lint_tree(const ASTNode* node) {
         const auto& stmts = prog->statements;
 
         if (stmts.empty()) {
-            diagnostics.push_back({ 0, 0, 0, 0, "Empty file", LintSeverity::WARNING });
-            return diagnostics;
+            if (!prog->has_dropped_whitespace) {
+                emit({ 0, 0, 0, 0, "Empty file", LintSeverity::WARNING });
+            }
+            return;
         }
 
         for (size_t i = 0; i < stmts.size(); ++i) {
             const auto* stmt = stmts[i].get();
 
+            if (cancel != nullptr && i % CANCELLATION_INTERVAL == 0) {
+                cancel->check();
+            }
+
             if (stmt->type == NodeType::COMMENT && i > 0 && i + 1 < stmts.size()) {
                 const auto* prev = stmts[i - 1].get();
                 const auto* next = stmts[i + 1].get();
 
-                if ((prev->type == NodeType::COMMAND || prev->type == NodeType::LOOP) && (next->type == NodeType::COMMAND || next->type == NodeType::LOOP)) {
-                    diagnostics.push_back({ stmt->start_line, stmt->start_column, stmt->end_line, stmt->end_column, "Comment between commands", LintSeverity::WARNING });
+                // Neighbours behind whitespace are not adjacent, whether the whitespace is a node or a flag
+                bool touches_prev = !stmt->follows_whitespace && (prev->type == NodeType::COMMAND || prev->type == NodeType::LOOP);
+                bool touches_next = !next->follows_whitespace && (next->type == NodeType::COMMAND || next->type == NodeType::LOOP);
+
+                if (touches_prev && touches_next) {
+                    emit({ stmt->start_line, stmt->start_column, stmt->end_line, stmt->end_column, "Comment between commands", LintSeverity::WARNING });
                 }
             }
 
@@ -37,59 +45,156 @@ std::vector<LintDiagnostic> lint_tree(const ASTNode* node) {
                 const auto* next = stmts[i + 1].get();
                 const auto* cmd1 = static_cast<const CommandNode*>(stmt);
 
-                if (next->type == NodeType::COMMAND) {
+                if (next->type == NodeType::COMMAND && !next->follows_whitespace) {
                     const auto* cmd2 = static_cast<const CommandNode*>(next);
 
-                    if ((cmd1->command == TokenType::INCREMENT && cmd2->command == TokenType::DECREMENT) || (cmd1->command == TokenType::DECREMENT && cmd2->command == TokenType::INCREMENT)
-                        || (cmd1->command == TokenType::MOVE_LEFT && cmd2->command == TokenType::MOVE_RIGHT) || (cmd1->command == TokenType::MOVE_RIGHT && cmd2->command == TokenType::MOVE_LEFT))
-                    {
-                        diagnostics.push_back({ cmd1->start_line, cmd1->start_column, cmd2->end_line, cmd2->end_column, "Consecutive canceling commands", LintSeverity::WARNING });
+                    if (are_canceling_commands(cmd1->command, cmd2->command)) {
+                        emit({ cmd1->start_line, cmd1->start_column, cmd2->end_line, cmd2->end_column, "Consecutive canceling commands", LintSeverity::WARNING });
                     }
                 }
             }
 
-            auto child_diags = lint_tree(stmt);
-            diagnostics.insert(diagnostics.end(), child_diags.begin(), child_diags.end());
+            lint_tree(stmt, emit, cancel);
         }
     } else if (node->type == NodeType::LOOP) {
         const auto* loop = static_cast<const LoopNode*>(node);
 
+        if (cancel != nullptr) {
+            cancel->check();
+        }
+
         if (!loop->is_terminated) {
-            diagnostics.push_back({ loop->start_line, loop->start_column, loop->end_line, loop->end_column, "Unmatched '[' - missing ']'", LintSeverity::ERROR });
+            emit({ loop->start_line, loop->start_column, loop->end_line, loop->end_column, "Unmatched '[' - missing ']'", LintSeverity::ERROR });
         }
 
         if (loop->is_empty) {
-            diagnostics.push_back({ loop->start_line, loop->start_column, loop->end_line, loop->end_column, "Empty loop (potential infinite loop)", LintSeverity::WARNING });
+            emit({ loop->start_line, loop->start_column, loop->end_line, loop->end_column, "Empty loop (potential infinite loop)", LintSeverity::WARNING });
         }
 
         if (loop->has_single_statement) {
-            diagnostics.push_back({ loop->start_line, loop->start_column, loop->end_line, loop->end_column, "Loop with single command (suspicious)", LintSeverity::WARNING });
+            emit({ loop->start_line, loop->start_column, loop->end_line, loop->end_column, "Loop with single command (suspicious)", LintSeverity::WARNING });
         }
 
         for (const auto& child: loop->body) {
-            auto nested_diags = lint_tree(child.get());
-            diagnostics.insert(diagnostics.end(), nested_diags.begin(), nested_diags.end());
+            lint_tree(child.get(), emit, cancel);
         }
     } else if (node->type == NodeType::UNMATCHED_CLOSE) {
-        diagnostics.push_back({ node->start_line, node->start_column, node->end_line, node->end_column, "Unmatched ']' - missing '['", LintSeverity::ERROR });
+        emit({ node->start_line, node->start_column, node->end_line, node->end_column, "Unmatched ']' - missing '['", LintSeverity::ERROR });
     }
+}
 
+std::vector<LintDiagnostic> lint_tree(const ASTNode* node) {
+    std::vector<LintDiagnostic> diagnostics;
+    lint_tree(node, [&](const LintDiagnostic& diagnostic) { diagnostics.push_back(diagnostic); });
     return diagnostics;
 }
 
+void lint_to_stream(const ASTNode* node, std::ostream& out, DiagnosticFormat format) {
+    DiagnosticWriter writer(out, format);
+
+    writer.begin();
+    lint_tree(node, [&](const LintDiagnostic& diagnostic) { writer.write(diagnostic); });
+    writer.end();
+}
+
 std::string lint_to_json(const ASTNode* node) {
-    json result = json::array();
-
-    for (const auto& report: lint_tree(node)) {
-        result.push_back(
-            { { "message", report.message },
-              { "level", level_to_string(report.severity) },
-              { "startLine", report.start_line },
-              { "startColumn", report.start_column },
-              { "endLine", report.end_line },
-              { "endColumn", report.end_column } }
-        );
+    std::ostringstream out;
+    lint_to_stream(node, out);
+    return out.str();
+}
+
+// Terminated loops without commands are dropped as a whole ("Empty loop").
+// is_empty only counts commands, so nested loops are checked bottom-up: a
+// loop whose body is empty once its own removable loops are gone goes too,
+// which makes [[]] disappear in one pass while [[-]] stays.
+static bool is_removable_loop(const ASTNode* node) {
+    if (node->type != NodeType::LOOP) {
+        return false;
+    }
+    const auto* loop = static_cast<const LoopNode*>(node);
+    if (!loop->is_terminated || !loop->is_empty) {
+        return false;
+    }
+
+    for (const auto& stmt: loop->body) {
+        if (stmt->type == NodeType::LOOP && !is_removable_loop(stmt.get())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void remove_node(const ASTNode* node, const LineIndex& lines, std::vector<TextEdit>& edits) {
+    edits.push_back({ lines.offset(node->start_line, node->start_column), lines.offset(node->end_line, node->end_column) + 1, "" });
+}
+
+// Loop bodies only receive the "Empty loop" fix, matching what lint_tree reports there
+static void collect_loop_fixes(const std::vector<std::unique_ptr<ASTNode>>& body, const LineIndex& lines, std::vector<TextEdit>& edits) {
+    for (const auto& stmt: body) {
+        if (is_removable_loop(stmt.get())) {
+            remove_node(stmt.get(), lines, edits);
+        } else if (stmt->type == NodeType::LOOP) {
+            collect_loop_fixes(static_cast<const LoopNode*>(stmt.get())->body, lines, edits);
+        }
+    }
+}
+
+std::vector<TextEdit> lint_fixes(const ProgramNode* root, const LineIndex& lines) {
+    std::vector<TextEdit> edits;
+
+    if (root == nullptr) {
+        return edits;
+    }
+
+    // Statements that survive the fixes so far. Removing a node makes its
+    // neighbours adjacent, so comparing every command against the top of this
+    // stack reaches the same fixpoint as re-linting after every removal,
+    // in a single pass over the tree.
+    std::vector<const ASTNode*> kept;
+
+    for (const auto& stmt_ptr: root->statements) {
+        const ASTNode* stmt = stmt_ptr.get();
+
+        // Stands in for the WhitespaceNode a TRIVIA_FREE parse left out
+        if (stmt->follows_whitespace) {
+            kept.push_back(nullptr);
+        }
+
+        if (is_removable_loop(stmt)) {
+            remove_node(stmt, lines, edits);
+            continue;
+        }
+
+        if (stmt->type == NodeType::COMMAND && !kept.empty() && kept.back() != nullptr && kept.back()->type == NodeType::COMMAND) {
+            const auto* prev = static_cast<const CommandNode*>(kept.back());
+            const auto* cmd = static_cast<const CommandNode*>(stmt);
+
+            if (are_canceling_commands(prev->command, cmd->command)) {
+                remove_node(prev, lines, edits);
+                remove_node(cmd, lines, edits);
+                kept.pop_back();
+                continue;
+            }
+        }
+
+        if (stmt->type == NodeType::LOOP) {
+            collect_loop_fixes(static_cast<const LoopNode*>(stmt)->body, lines, edits);
+        }
+
+        kept.push_back(stmt);
+    }
+
+    std::sort(edits.begin(), edits.end(), [](const TextEdit& a, const TextEdit& b) { return a.start_offset < b.start_offset; });
+
+    // Merge touching removals so every run of deleted bytes becomes one edit
+    std::vector<TextEdit> merged;
+    for (auto& edit: edits) {
+        if (!merged.empty() && merged.back().end_offset == edit.start_offset) {
+            merged.back().end_offset = edit.end_offset;
+        } else {
+            merged.push_back(std::move(edit));
+        }
     }
 
-    return result.dump();
+    return merged;
 }
@@ -1,11 +1,20 @@
 #pragma once
 
+#include "cancellation.hpp"
 #include "parser.hpp"
+#include "source.hpp"
+#include <functional>
+#include <ostream>
 #include <string>
 #include <vector>
 
 enum class LintSeverity { INFO, WARNING, ERROR };
 
+enum class DiagnosticFormat {
+    ARRAY, // a single JSON array, as returned by lint_to_json
+    NDJSON // one JSON object per line, flushed as soon as it is found
+};
+
 inline std::string level_to_string(LintSeverity severity) {
     switch (severity) {
         case LintSeverity::INFO: return "info";
@@ -15,6 +24,12 @@ inline std::string level_to_string(LintSeverity severity) {
     }
 }
 
+// +- -+ <> >< undo each other
+inline bool are_canceling_commands(TokenType a, TokenType b) {
+    return (a == TokenType::INCREMENT && b == TokenType::DECREMENT) || (a == TokenType::DECREMENT && b == TokenType::INCREMENT) || (a == TokenType::MOVE_LEFT && b == TokenType::MOVE_RIGHT)
+        || (a == TokenType::MOVE_RIGHT && b == TokenType::MOVE_LEFT);
+}
+
 struct LintDiagnostic {
     size_t start_line;
     size_t start_column;
@@ -24,5 +39,15 @@ struct LintDiagnostic {
     LintSeverity severity;
 };
 
+using LintCallback = std::function<void(const LintDiagnostic&)>;
+
+// With a cancellation token, linting stops with OperationCancelled soon
+// after the token is cancelled
+void lint_tree(const ASTNode* node, const LintCallback& emit, const CancellationToken* cancel = nullptr);
 std::vector<LintDiagnostic> lint_tree(const ASTNode* node);
+void lint_to_stream(const ASTNode* node, std::ostream& out, DiagnosticFormat format = DiagnosticFormat::ARRAY);
 std::string lint_to_json(const ASTNode* node);
+
+// Source edits that resolve every "Consecutive canceling commands" and
+// "Empty loop" diagnostic, including the ones exposed by earlier fixes
+std::vector<TextEdit> lint_fixes(const ProgramNode* root, const LineIndex& lines);
@@ -0,0 +1,481 @@
+#include "lsp_server.hpp"
+#include "formatter.hpp"
+#include "json_rpc.hpp"
+#include "linter.hpp"
+#include "parser.hpp"
+#include "piece_table.hpp"
+#include "scheduler.hpp"
+#include "source.hpp"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// The text of a document at one version together with its AST. Never
+// changed once built, so it can be shared with running jobs.
+struct Analysis {
+    int64_t version;
+    std::string text;
+    std::unique_ptr<ProgramNode> ast;
+};
+
+// An open editor buffer. Edits go to the piece table; the flat text and the
+// AST are only built when a job needs them.
+struct LspDocument {
+    PieceTable text;
+    int64_t version = 0;
+    std::shared_ptr<const Analysis> analysis; // of the latest version analyzed
+};
+
+// Diagnostics wait for a pause in typing, so a burst of changes is linted once
+static constexpr std::chrono::milliseconds LINT_DELAY { 50 };
+
+// Larger bodies are skipped rather than buffered
+static constexpr size_t MAX_MESSAGE_SIZE = 64 * 1024 * 1024;
+
+enum class ReadStatus {
+    MESSAGE, // body holds the next message
+    INVALID, // a frame was dropped, error says why
+    END
+};
+
+// Read one Content-Length framed message
+static ReadStatus read_message(std::istream& in, std::string& body, std::string& error) {
+    std::string header;
+    size_t content_length = 0;
+    bool has_length = false;
+    bool bad_length = false;
+
+    while (std::getline(in, header)) {
+        if (!header.empty() && header.back() == '\r') {
+            header.pop_back();
+        }
+        if (header.empty()) {
+            // Without a usable length the body cannot be found, so reading
+            // resumes with whatever header comes next
+            if (bad_length) {
+                return ReadStatus::INVALID;
+            }
+            if (!has_length) {
+                continue; // stray blank line between messages
+            }
+
+            if (content_length > MAX_MESSAGE_SIZE) {
+                in.ignore(static_cast<std::streamsize>(std::min<size_t>(content_length, std::numeric_limits<std::streamsize>::max() - 1)));
+                error = "Message too large: " + std::to_string(content_length) + " bytes";
+                return in ? ReadStatus::INVALID : ReadStatus::END;
+            }
+
+            body.resize(content_length);
+            in.read(body.data(), static_cast<std::streamsize>(content_length));
+            return static_cast<size_t>(in.gcount()) == content_length ? ReadStatus::MESSAGE : ReadStatus::END;
+        }
+
+        static const std::string length_header = "content-length:";
+        if (header.size() > length_header.size()) {
+            std::string name = header.substr(0, length_header.size());
+            for (char& c: name) {
+                c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            }
+            if (name == length_header) {
+                std::string_view value(header);
+                value.remove_prefix(length_header.size());
+                while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+                    value.remove_prefix(1);
+                }
+                while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+                    value.remove_suffix(1);
+                }
+
+                const char* end = value.data() + value.size();
+                auto result = std::from_chars(value.data(), end, content_length);
+
+                has_length = !value.empty() && result.ec == std::errc() && result.ptr == end;
+                bad_length = !has_length;
+                if (bad_length) {
+                    error = "Invalid Content-Length: \"" + std::string(value) + "\"";
+                }
+            }
+        }
+    }
+    return ReadStatus::END;
+}
+
+// UTF-16 column of a byte offset on its line, as LSP counts characters
+static size_t utf16_column(std::string_view text, size_t line_start, size_t offset) {
+    size_t column = 0;
+
+    for (size_t i = line_start; i < offset && i < text.size(); ++i) {
+        auto byte = static_cast<unsigned char>(text[i]);
+        if ((byte & 0xC0) != 0x80) {
+            column += byte >= 0xF0 ? 2 : 1;
+        }
+    }
+    return column;
+}
+
+static json lsp_position(std::string_view text, const LineIndex& lines, size_t offset) {
+    size_t line = lines.line_of(offset);
+    return { { "line", line - 1 }, { "character", utf16_column(text, lines.line_start(line), offset) } };
+}
+
+static json lsp_range(std::string_view text, const LineIndex& lines, size_t start, size_t end) {
+    return { { "start", lsp_position(text, lines, start) }, { "end", lsp_position(text, lines, end) } };
+}
+
+static int lsp_severity(LintSeverity severity) {
+    switch (severity) {
+        case LintSeverity::ERROR: return 1;
+        case LintSeverity::WARNING: return 2;
+        default: return 3;
+    }
+}
+
+// The editor's formatting options override the indentation settings
+static FormatterConfig formatter_config(const json& params) {
+    FormatterConfig config;
+    json options = params.value("options", json::object());
+
+    if (options.contains("insertSpaces")) {
+        config.tab_indent = !options.at("insertSpaces").get<bool>();
+    }
+    if (options.contains("tabSize")) {
+        config.indent_spaces = options.at("tabSize").get<int>();
+    }
+    return config;
+}
+
+// Requests and notifications are read on the calling thread, which only
+// updates documents; linting and formatting run on the scheduler, so a change
+// arriving meanwhile cancels the work for the version it replaces
+class LspServer {
+public:
+    LspServer(std::istream& in, std::ostream& out): in(in), out(out) {}
+
+    int run() {
+        std::string body;
+        std::string error;
+
+        while (!exiting) {
+            ReadStatus status = read_message(in, body, error);
+
+            if (status == ReadStatus::END) {
+                break;
+            }
+            if (status == ReadStatus::INVALID) {
+                send(rpc_error(nullptr, INVALID_REQUEST, error));
+                continue;
+            }
+            handle_message(body);
+        }
+
+        scheduler.drain();
+        return shutdown_requested ? 0 : 1;
+    }
+
+private:
+    std::istream& in;
+    std::ostream& out;
+    std::mutex output_mutex;
+    bool shutdown_requested = false;
+    bool exiting = false;
+
+    std::mutex documents_mutex;
+    std::unordered_map<std::string, LspDocument> documents;
+
+    // Only used by jobs, which all run on the scheduler thread
+    BrainfuckLexer lexer;
+    BrainfuckParser parser;
+    std::vector<Token> tokens;
+
+    // Last member, so that it stops before anything its jobs use goes away
+    Scheduler scheduler;
+
+    void send(const json& message) {
+        std::string body = message.dump();
+
+        std::lock_guard<std::mutex> lock(output_mutex);
+        out << "Content-Length: " << body.size() << "\r\n\r\n" << body;
+        out.flush();
+    }
+
+    void handle_message(const std::string& body) {
+        json message = json::parse(body, nullptr, false);
+
+        if (message.is_discarded() || !message.is_object()) {
+            send(rpc_error(nullptr, PARSE_ERROR, "Parse error"));
+            return;
+        }
+
+        // Notifications never get a response, not even for errors
+        bool is_notification = !message.contains("id");
+
+        if (!message.contains("method") || !message["method"].is_string()) {
+            if (!is_notification) {
+                send(rpc_error(message["id"], INVALID_REQUEST, "Invalid request"));
+            }
+            return;
+        }
+
+        std::string method = message["method"].get<std::string>();
+        json params = message.contains("params") ? message["params"] : json::object();
+
+        if (is_notification) {
+            try {
+                notify(method, params);
+            } catch (const std::exception&) {
+            }
+            return;
+        }
+
+        json id = message["id"];
+        try {
+            request(id, method, params);
+        } catch (const RpcError& e) {
+            send(rpc_error(id, e.code, e.what()));
+        } catch (const json::exception& e) {
+            send(rpc_error(id, INVALID_PARAMS, e.what()));
+        } catch (const std::exception& e) {
+            send(rpc_error(id, INTERNAL_ERROR, e.what()));
+        }
+    }
+
+    void request(const json& id, const std::string& method, const json& params) {
+        if (method == "initialize") {
+            send(rpc_result(id,
+                            { { "capabilities",
+                                { { "textDocumentSync", { { "openClose", true }, { "change", 2 } } }, // incremental
+                                  { "documentFormattingProvider", true },
+                                  { "documentRangeFormattingProvider", true } } },
+                              { "serverInfo", { { "name", "brain-surgeon" } } } }));
+        } else if (method == "shutdown") {
+            // Nothing was modified, so waiting requests get their real answer
+            scheduler.drain();
+            shutdown_requested = true;
+            send(rpc_result(id, nullptr));
+        } else if (method == "textDocument/formatting" || method == "textDocument/rangeFormatting") {
+            schedule_format(id, params, method == "textDocument/rangeFormatting");
+        } else {
+            throw RpcError(METHOD_NOT_FOUND, "Method not found: " + method);
+        }
+    }
+
+    void notify(const std::string& method, const json& params) {
+        if (method == "exit") {
+            exiting = true;
+        } else if (method == "textDocument/didOpen") {
+            const json& item = params.at("textDocument");
+            std::string uri = item.at("uri").get<std::string>();
+            {
+                std::lock_guard<std::mutex> lock(documents_mutex);
+                LspDocument& doc = documents[uri];
+
+                doc.text = PieceTable(item.at("text").get<std::string>());
+                doc.version = item.value("version", int64_t(0));
+                doc.analysis.reset();
+            }
+            schedule_lint(uri, std::chrono::milliseconds(0));
+        } else if (method == "textDocument/didChange") {
+            std::string uri = params.at("textDocument").at("uri").get<std::string>();
+            {
+                std::lock_guard<std::mutex> lock(documents_mutex);
+                auto found = documents.find(uri);
+                if (found == documents.end()) {
+                    return;
+                }
+
+                LspDocument& doc = found->second;
+                for (const auto& change: params.at("contentChanges")) {
+                    apply_change(doc, change);
+                }
+                doc.version = params.at("textDocument").value("version", doc.version + 1);
+            }
+
+            // Formatting edits for the old text would no longer apply
+            scheduler.cancel("format:" + uri);
+            schedule_lint(uri, LINT_DELAY);
+        } else if (method == "textDocument/didClose") {
+            std::string uri = params.at("textDocument").at("uri").get<std::string>();
+            {
+                std::lock_guard<std::mutex> lock(documents_mutex);
+                documents.erase(uri);
+            }
+
+            scheduler.cancel("lint:" + uri);
+            scheduler.cancel("format:" + uri);
+            send({ { "jsonrpc", "2.0" }, { "method", "textDocument/publishDiagnostics" }, { "params", { { "uri", uri }, { "diagnostics", json::array() } } } });
+        }
+    }
+
+    static void apply_change(LspDocument& doc, const json& change) {
+        std::string text = change.at("text").get<std::string>();
+
+        // A change without a range replaces the whole document
+        if (!change.contains("range")) {
+            doc.text = PieceTable(std::move(text));
+            return;
+        }
+
+        const json& range = change.at("range");
+        size_t start = doc.text.offset(range.at("start").at("line").get<size_t>(), range.at("start").at("character").get<size_t>());
+        size_t end = doc.text.offset(range.at("end").at("line").get<size_t>(), range.at("end").at("character").get<size_t>());
+        doc.text.replace(start, end, text);
+    }
+
+    // The analysis of the latest version of a document, built on the
+    // scheduler thread if needed; null once the document is closed
+    std::shared_ptr<const Analysis> analyze(const std::string& uri, const CancellationToken& cancel) {
+        auto result = std::make_shared<Analysis>();
+        {
+            std::lock_guard<std::mutex> lock(documents_mutex);
+            auto found = documents.find(uri);
+            if (found == documents.end()) {
+                return nullptr;
+            }
+
+            LspDocument& doc = found->second;
+            if (doc.analysis != nullptr && doc.analysis->version == doc.version) {
+                return doc.analysis;
+            }
+            result->version = doc.version;
+            doc.text.copy_to(result->text);
+        }
+
+        cancel.check();
+        lexer.tokenize(result->text, tokens);
+        result->ast = parser.parse(tokens);
+
+        std::lock_guard<std::mutex> lock(documents_mutex);
+        auto found = documents.find(uri);
+        if (found != documents.end() && found->second.version == result->version) {
+            found->second.analysis = result;
+        }
+        return result;
+    }
+
+    void schedule_lint(const std::string& uri, std::chrono::milliseconds delay) {
+        Scheduler::Job job;
+        job.delay = delay;
+        job.run = [this, uri](const CancellationToken& cancel) {
+            std::shared_ptr<const Analysis> analysis = analyze(uri, cancel);
+            if (analysis != nullptr) {
+                publish_diagnostics(uri, *analysis, cancel);
+            }
+        };
+        scheduler.schedule("lint:" + uri, std::move(job));
+    }
+
+    void publish_diagnostics(const std::string& uri, const Analysis& analysis, const CancellationToken& cancel) {
+        const std::string& text = analysis.text;
+        LineIndex lines(text);
+        json diagnostics = json::array();
+
+        lint_tree(
+            analysis.ast.get(),
+            [&](const LintDiagnostic& diagnostic) {
+                // Diagnostic columns are 1-based with an inclusive end
+                size_t start = lines.offset(diagnostic.start_line, diagnostic.start_column);
+                size_t end = std::min(lines.offset(diagnostic.end_line, diagnostic.end_column) + 1, text.size());
+
+                diagnostics.push_back({ { "range", lsp_range(text, lines, start, std::max(start, end)) },
+                                        { "severity", lsp_severity(diagnostic.severity) },
+                                        { "source", "brain-surgeon" },
+                                        { "message", diagnostic.message } });
+            },
+            &cancel);
+
+        // Diagnostics of a version that was replaced meanwhile are not sent
+        cancel.check();
+        send({ { "jsonrpc", "2.0" },
+               { "method", "textDocument/publishDiagnostics" },
+               { "params", { { "uri", uri }, { "version", analysis.version }, { "diagnostics", diagnostics } } } });
+    }
+
+    // A newer formatting request for the same document replaces a waiting one,
+    // and every change cancels it; both answer with ContentModified
+    void schedule_format(const json& id, const json& params, bool in_range) {
+        std::string uri = params.at("textDocument").at("uri").get<std::string>();
+        {
+            std::lock_guard<std::mutex> lock(documents_mutex);
+            if (documents.count(uri) == 0) {
+                throw RpcError(INVALID_PARAMS, "Document is not open: " + uri);
+            }
+        }
+
+        Scheduler::Job job;
+        job.run = [this, id, params, uri, in_range](const CancellationToken& cancel) {
+            try {
+                std::shared_ptr<const Analysis> analysis = analyze(uri, cancel);
+                if (analysis == nullptr) {
+                    throw RpcError(CONTENT_MODIFIED, "Document was closed");
+                }
+
+                json result = format(*analysis, params, in_range, cancel);
+                cancel.check();
+                send(rpc_result(id, std::move(result)));
+            } catch (const RpcError& e) {
+                send(rpc_error(id, e.code, e.what()));
+            } catch (const json::exception& e) {
+                send(rpc_error(id, INVALID_PARAMS, e.what()));
+            } catch (const OperationCancelled&) {
+                throw;
+            } catch (const std::exception& e) {
+                send(rpc_error(id, INTERNAL_ERROR, e.what()));
+            }
+        };
+        job.on_cancel = [this, id]() { send(rpc_error(id, CONTENT_MODIFIED, "Content modified")); };
+
+        scheduler.schedule("format:" + uri, std::move(job));
+    }
+
+    json format(const Analysis& analysis, const json& params, bool in_range, const CancellationToken& cancel) {
+        const std::string& text = analysis.text;
+        FormatterConfig config = formatter_config(params);
+        LineIndex lines(text);
+        std::vector<TextEdit> edits;
+
+        if (in_range) {
+            const json& range = params.at("range");
+            size_t start_line = range.at("start").at("line").get<size_t>() + 1;
+            size_t end_line = range.at("end").at("line").get<size_t>() + 1;
+
+            // A selection ending at the start of a line does not include it
+            if (end_line > start_line && range.at("end").at("character").get<size_t>() == 0) {
+                end_line--;
+            }
+
+            try {
+                FormattedRange formatted = format_range(analysis.ast.get(), config, start_line, end_line);
+                TextEdit edit = range_edit(formatted, lines);
+
+                // Reduce the replaced lines to the bytes that really change
+                std::string_view old_text = std::string_view(text).substr(edit.start_offset, edit.end_offset - edit.start_offset);
+                for (auto& change: formatting_edits(old_text, edit.replacement)) {
+                    edits.push_back({ change.start_offset + edit.start_offset, change.end_offset + edit.start_offset, std::move(change.replacement) });
+                }
+            } catch (const std::out_of_range&) {
+                return json::array(); // nothing to format in the selection
+            }
+        } else {
+            OutputBuffer formatted;
+            format_tree(analysis.ast.get(), config, formatted, cancel);
+            edits = formatting_edits(text, formatted.buffered());
+        }
+
+        json result = json::array();
+        for (const auto& edit: edits) {
+            result.push_back({ { "range", lsp_range(text, lines, edit.start_offset, edit.end_offset) }, { "newText", edit.replacement } });
+        }
+        return result;
+    }
+};
+
+int serve_lsp(std::istream& in, std::ostream& out) {
+    LspServer server(in, out);
+    return server.run();
+}
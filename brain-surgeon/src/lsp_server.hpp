@@ -0,0 +1,9 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+
+// Language server for editors, speaking LSP over Content-Length framed
+// JSON-RPC. Supports incremental text sync, publishDiagnostics, formatting
+// and rangeFormatting. Returns the exit code the protocol asks for.
+int serve_lsp(std::istream& in, std::ostream& out);
@@ -1,68 +1,595 @@
+#include "batch.hpp"
+#include "file_io.hpp"
+#include "file_walker.hpp"
 #include "formatter.hpp"
+#include "json_writer.hpp"
 #include "lexer.hpp"
 #include "linter.hpp"
+#include "lsp_server.hpp"
+#include "minifier.hpp"
+#include "optimizer.hpp"
 #include "parser.hpp"
+#include "run_stats.hpp"
+#include "server.hpp"
+#include "watcher.hpp"
+#include <algorithm>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
 
-std::string read_file(const std::string& filename) {
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        throw std::runtime_error("Cannot open file: " + filename);
+// Open a file for reading, closing it again when the scope ends; STDIN_PATH
+// reads standard input
+class InputFile {
+public:
+    explicit InputFile(const std::string& filepath): file(filepath == STDIN_PATH ? STDIN_FILENO : open(filepath.c_str(), O_RDONLY)) {
+        if (file < 0) {
+            throw std::runtime_error("Cannot open file: " + filepath);
+        }
+    }
+    ~InputFile() {
+        if (file != STDIN_FILENO) {
+            close(file);
+        }
+    }
+
+    InputFile(const InputFile&) = delete;
+    InputFile& operator=(const InputFile&) = delete;
+
+    int fd() const { return file; }
+
+private:
+    int file;
+};
+
+// Command line options that apply to every file of a run
+struct CommandOptions {
+    std::string command;
+    DiagnosticFormat diagnostic_format = DiagnosticFormat::ARRAY;
+    bool fix = false;
+    bool stream = false;
+    bool check = false;
+    bool edits_only = false;
+    bool fold = false;
+    bool optimize = false;
+    bool to_stdout = false; // fmt writes the result to stdout instead of the file
+    bool watch_format = false;
+    size_t range_start = 0;
+    size_t range_end = 0;
+    size_t jobs = 1;
+    bool batch = false; // several files, reported one JSON object or line each
+    FormatterConfig fmt_config;
+    RunStats* stats = nullptr; // set by --stats and --trace, shared by every thread
+    bool print_stats = false;
+    bool stats_json = false;
+    std::string trace_path;
+};
+
+// Lexer, parser and token buffer reused for every file a thread processes
+struct Workspace {
+    BrainfuckLexer lexer;
+    BrainfuckParser parser;
+    std::vector<Token> tokens;
+
+    std::unique_ptr<ProgramNode> parse(std::string_view source, RunStats* stats, ParseMode mode = ParseMode::FULL) {
+        PhaseTimer tokenize_timer(stats, Phase::TOKENIZE);
+        lexer.tokenize(source, tokens);
+        tokenize_timer.finish(source.size());
+
+        PhaseTimer parse_timer(stats, Phase::PARSE);
+        auto ast = parser.parse(tokens, mode);
+        parse_timer.finish(source.size());
+
+        if (stats != nullptr) {
+            stats->add_tokens(tokens.size());
+            stats->add_tree(ast.get());
+        }
+        return ast;
     }
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    return buffer.str();
+};
+
+// Format without ever holding the whole file: tokens are read in chunks and
+// the output goes to a temporary file that replaces the original when done
+void format_file_streaming(const std::string& filepath, const FormatterConfig& config) {
+    InputFile input(filepath);
+    AtomicFile target(filepath);
+    OutputBuffer output(target.fd());
+
+    format_stream(input.fd(), config, output);
+    target.commit();
 }
 
-void write_file(const std::string& filename, const std::string& content) {
-    std::ofstream file(filename);
-    if (!file.is_open()) {
-        throw std::runtime_error("Cannot write to file: " + filename);
+void print_usage(const char* program) {
+    std::cerr << "Usage:\n"
+              << "  " << program << " lint [--ndjson] [--fix] [--jobs N] <file.bf | dir>...  # Lint Brainfuck files\n"
+              << "  " << program << " fmt [--stream | --range L1:L2 | --jobs N | --check | --edits] [--optimize] [--stdout] <file.bf | dir>...  # Format Brainfuck files (writes to file)\n"
+              << "  " << program << " min [--fold] <file.bf>                  # Write the program without comments and whitespace to stdout\n"
+              << "  " << program << " debug <file.bf>                         # Parse, print AST, lint\n"
+              << "  " << program << " watch [--fmt] [--jobs N] <dir>...      # Lint (and format) files again whenever they change, as NDJSON\n"
+              << "  " << program << " serve                                   # Answer JSON-RPC requests on stdin, one per line\n"
+              << "  " << program << " lsp                                     # Run as a language server on stdin/stdout\n"
+              << "\n"
+              << "Options:\n"
+              << "  --ndjson    Stream lint diagnostics as one JSON object per line\n"
+              << "  --fix       Remove canceling commands and empty loops before linting\n"
+              << "  --stream    Format in bounded memory without building the whole AST\n"
+              << "  --range     Only format the top-level statements on lines L1 to L2\n"
+              << "  --jobs N    Format top-level statements, or process files, on N threads (0 = all cores)\n"
+              << "  --check     Only report whether the file is formatted (exit code 1 if not)\n"
+              << "  --edits     Print the changes formatting would make as JSON instead of writing\n"
+              << "  --fold      Replace runs of +/- and </> by their net effect when minifying\n"
+              << "  --optimize  Remove canceling commands and loops that never run while formatting\n"
+              << "  --stdout    Write the formatted program to stdout instead of the file\n"
+              << "  --stats     Print time and throughput per phase, counts and peak memory to stderr (--stats=json for JSON)\n"
+              << "  --fmt       (watch) Format changed files before linting them\n"
+              << "  --trace F   Write a Chrome trace of every phase, per file and thread, to F\n"
+              << "\n"
+              << "A file named - is read from stdin; fmt then writes to stdout.\n";
+}
+
+// Size of a regular file, for the throughput of the streaming modes
+static size_t input_size(int fd) {
+    struct stat info;
+    return fstat(fd, &info) == 0 && S_ISREG(info.st_mode) ? static_cast<size_t>(info.st_size) : 0;
+}
+
+// Lint one file. With several files every file becomes a single line
+// {"file": ..., "diagnostics": [...]}, or with --ndjson every diagnostic a
+// line of its own that also names the file.
+int lint_file(const CommandOptions& options, const std::string& filepath, Workspace& workspace, std::ostream& out, std::ostream& err) {
+    PhaseTimer read_timer(options.stats, Phase::READ);
+    std::string source = read_file(filepath);
+    read_timer.finish(source.size());
+
+    // Linting never looks at whitespace or comment text
+    auto ast = workspace.parse(source, options.stats, ParseMode::TRIVIA_FREE);
+    std::string fixed;
+
+    if (options.fix) {
+        std::vector<TextEdit> edits = lint_fixes(ast.get(), LineIndex(source));
+
+        if (!edits.empty()) {
+            fixed = apply_edits(source, edits);
+            {
+                PhaseTimer output_timer(options.stats, Phase::OUTPUT, fixed.size());
+                write_file(filepath, fixed);
+            }
+            ast = workspace.parse(fixed, options.stats, ParseMode::TRIVIA_FREE);
+            err << "Applied " << edits.size() << " fix(es) to " << filepath << "\n";
+        }
+    }
+
+    // Diagnostics are written while they are found, so output is part of this
+    PhaseTimer lint_timer(options.stats, Phase::LINT, source.size());
+
+    // Several files with --ndjson: every diagnostic line names its file
+    if (options.batch && options.diagnostic_format == DiagnosticFormat::NDJSON) {
+        std::string prefix = "{\"file\":";
+        append_json_string(prefix, filepath);
+        prefix += ',';
+
+        std::string line;
+        lint_tree(ast.get(), [&](const LintDiagnostic& diagnostic) {
+            line.assign(prefix);
+            append_diagnostic_json(line, diagnostic);
+            line.erase(prefix.size(), 1); // the diagnostic's own '{'
+            line += '\n';
+            out << line;
+        });
+        return 0;
+    }
+
+    if (options.batch) {
+        std::string prefix = "{\"file\":";
+        append_json_string(prefix, filepath);
+        prefix += ",\"diagnostics\":";
+
+        out << prefix;
+        lint_to_stream(ast.get(), out, DiagnosticFormat::ARRAY);
+        out << "}\n";
+        return 0;
     }
-    file << content;
+
+    lint_to_stream(ast.get(), out, options.diagnostic_format);
+    if (options.diagnostic_format == DiagnosticFormat::ARRAY) {
+        out << std::endl;
+    }
+    return 0;
+}
+
+// Line of the first byte where two texts differ
+static size_t first_difference_line(std::string_view a, std::string_view b) {
+    size_t length = std::min(a.size(), b.size());
+    size_t offset = static_cast<size_t>(std::mismatch(a.begin(), a.begin() + length, b.begin()).first - a.begin());
+
+    return 1 + static_cast<size_t>(std::count(a.begin(), a.begin() + offset, '\n'));
+}
+
+int format_file(const CommandOptions& options, const std::string& filepath, Workspace& workspace, std::ostream& out, std::ostream& err) {
+    const FormatterConfig& fmt_config = options.fmt_config;
+
+    // Standard input cannot be written back, nor be read twice for --check
+    bool from_stdin = filepath == STDIN_PATH;
+    bool to_stdout = options.to_stdout || from_stdin;
+
+    if (options.check && !from_stdin) {
+        InputFile input(filepath);
+        InputFile original(filepath);
+        PhaseTimer format_timer(options.stats, Phase::FORMAT, input_size(input.fd()));
+        FormatCheck result = check_format(input.fd(), original.fd(), fmt_config);
+
+        if (!result.is_formatted) {
+            out << filepath << ": not formatted (first difference on line " << result.line << ")" << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // Like a file, stdin is checked as a whole; that needs it in memory, so
+    // --stream and --range do not apply there
+    bool stream = options.stream && !options.check;
+    bool range = options.range_start > 0 && !options.check;
+
+    if (stream && to_stdout) {
+        InputFile input(filepath);
+        OutputBuffer output(STDOUT_FILENO);
+        PhaseTimer format_timer(options.stats, Phase::FORMAT, input_size(input.fd()));
+
+        format_stream(input.fd(), fmt_config, output);
+        return 0;
+    }
+
+    if (stream) {
+        // Comparing first keeps formatted files untouched, still in bounded memory
+        InputFile input(filepath);
+        InputFile original(filepath);
+        PhaseTimer format_timer(options.stats, Phase::FORMAT, input_size(input.fd()));
+        if (check_format(input.fd(), original.fd(), fmt_config).is_formatted) {
+            out << "Already formatted " << filepath << std::endl;
+            return 0;
+        }
+
+        format_file_streaming(filepath, fmt_config);
+        out << "Formatted and wrote to " << filepath << std::endl;
+        return 0;
+    }
+
+    PhaseTimer read_timer(options.stats, Phase::READ);
+    std::string source = read_file(filepath);
+    read_timer.finish(source.size());
+
+    auto ast = workspace.parse(source, options.stats);
+
+    if (range) {
+        LineIndex lines(source);
+        FormattedRange range = format_range(ast.get(), fmt_config, options.range_start, options.range_end);
+
+        if (to_stdout) {
+            out << apply_edits(source, { range_edit(range, lines) });
+            out.flush();
+        } else if (update_file(filepath, apply_edits(source, { range_edit(range, lines) }), source)) {
+            out << "Formatted lines " << range.start_line << "-" << range.end_line << " and wrote to " << filepath << std::endl;
+        } else {
+            out << "Lines " << range.start_line << "-" << range.end_line << " of " << filepath << " are already formatted" << std::endl;
+        }
+        return 0;
+    }
+
+    if (options.optimize) {
+        PhaseTimer optimize_timer(options.stats, Phase::OPTIMIZE, source.size());
+        OptimizeStats stats = optimize_tree(ast.get());
+        err << "Optimized " << filepath << ": removed " << stats.removed_commands << " command(s) and " << stats.removed_loops << " loop(s), rewrote " << stats.canonical_loops
+            << " [+] loop(s)\n";
+    }
+
+    // Formatting mostly adds whitespace, so presize the buffer once
+    OutputBuffer formatted;
+    formatted.reserve(source.size() + source.size() / 2);
+    {
+        PhaseTimer format_timer(options.stats, Phase::FORMAT, source.size());
+        if (options.jobs == 1 || options.batch) {
+            format_tree(ast.get(), fmt_config, formatted);
+        } else {
+            ThreadPool pool(options.jobs);
+            format_tree_parallel(ast.get(), fmt_config, formatted, pool);
+        }
+    }
+
+    PhaseTimer output_timer(options.stats, Phase::OUTPUT, formatted.buffered().size());
+
+    if (options.check) {
+        if (formatted.buffered() != source) {
+            out << "<stdin>: not formatted (first difference on line " << first_difference_line(source, formatted.buffered()) << ")" << std::endl;
+            return 1;
+        }
+    } else if (options.edits_only) {
+        std::string text;
+        if (options.batch) {
+            text = "{\"file\":";
+            append_json_string(text, filepath);
+            text += ",\"edits\":";
+        }
+        out << text;
+        write_edits_json(out, formatting_edits(source, formatted.buffered()), LineIndex(source));
+        out << (options.batch ? "}\n" : "\n");
+        out.flush();
+    } else if (to_stdout) {
+        out << formatted.buffered();
+        out.flush();
+    } else if (update_file(filepath, formatted.buffered(), source)) {
+        out << "Formatted and wrote to " << filepath << std::endl;
+    } else {
+        out << "Already formatted " << filepath << std::endl;
+    }
+    return 0;
+}
+
+int run_file(const CommandOptions& options, const std::string& filepath, Workspace& workspace, std::ostream& out, std::ostream& err) {
+    FileScope file_scope(options.stats, filepath);
+
+    if (options.command == "lint") {
+        return lint_file(options, filepath, workspace, out, err);
+    }
+    if (options.command == "fmt") {
+        return format_file(options, filepath, workspace, out, err);
+    }
+
+    if (options.command == "min") {
+        InputFile input(filepath);
+        OutputBuffer output(STDOUT_FILENO);
+        PhaseTimer format_timer(options.stats, Phase::FORMAT);
+        MinifyResult result = minify_stream(input.fd(), output, options.fold);
+        format_timer.finish(result.input_bytes);
+
+        err << "Minified " << filepath << ": " << result.input_bytes << " -> " << result.output_bytes << " bytes";
+        if (result.input_bytes > 0) {
+            // Signed, since the output can outgrow an input with little to strip
+            int64_t saved = static_cast<int64_t>(result.input_bytes) - static_cast<int64_t>(result.output_bytes);
+            int64_t percent = saved * 100 / static_cast<int64_t>(result.input_bytes);
+
+            err << " (" << (percent < 0 ? -percent : percent) << (saved < 0 ? "% larger)" : "% smaller)");
+        }
+        err << "\n";
+        return 0;
+    }
+
+    if (options.command == "debug") {
+        std::string source = read_file(filepath);
+        auto ast = workspace.parse(source, options.stats);
+
+        out << "AST =================" << std::endl << tree_to_string(ast.get()) << std::endl;
+        out << "Linting =============" << std::endl << lint_to_json(ast.get()) << std::endl;
+        out << "Formatting ==========" << std::endl << format_tree(ast.get(), options.fmt_config) << std::endl;
+        return 0;
+    }
+
+    err << "Unknown command: " << options.command << "\n";
+    return 1;
+}
+
+// Print --stats and write the --trace file once every file is done
+static int report_stats(const CommandOptions& options, const TraceRecorder& trace, int status) {
+    if (options.print_stats) {
+        options.stats->write(std::cerr, options.stats_json);
+    }
+
+    if (!options.trace_path.empty()) {
+        std::ofstream file(options.trace_path);
+        trace.write(file);
+
+        if (!file) {
+            std::cerr << "Cannot write trace: " << options.trace_path << "\n";
+            return 1;
+        }
+    }
+    return status;
 }
 
 int main(int argc, char* argv[]) {
+    if (argc == 2 && std::string(argv[1]) == "serve") {
+        std::ios::sync_with_stdio(false);
+        return serve(std::cin, std::cout);
+    }
+    if (argc == 2 && std::string(argv[1]) == "lsp") {
+        // Replies are written from the scheduler thread, so reading must not
+        // flush cout behind the back of the server's output lock
+        std::ios::sync_with_stdio(false);
+        std::cin.tie(nullptr);
+        return serve_lsp(std::cin, std::cout);
+    }
+
     if (argc < 3) {
-        std::cerr << "Usage:\n"
-                  << "  " << argv[0] << " lint <file.bf>    # Lint Brainfuck file\n"
-                  << "  " << argv[0] << " fmt <file.bf>     # Format Brainfuck file (writes to file)\n"
-                  << "  " << argv[0] << " debug <file.bf>   # Parse, print AST, lint\n";
+        print_usage(argv[0]);
         return 1;
     }
 
-    std::string command = argv[1];
-    std::string filepath = argv[2];
+    CommandOptions options;
+    std::vector<std::string> filepaths;
+    RunStats run_stats;
+    TraceRecorder trace;
 
-    try {
-        BrainfuckLexer lexer;
-        BrainfuckParser parser;
-        FormatterConfig fmt_config;
+    options.command = argv[1];
 
-        std::string source = read_file(filepath);
-        std::vector<Token> tokens = lexer.tokenize(source);
-        auto ast = parser.parse(tokens);
-
-        if (command == "lint") {
-            std::cout << lint_to_json(ast.get()) << std::endl;
-        } else if (command == "fmt") {
-            std::string formatted = format_tree(ast.get(), fmt_config);
-            write_file(filepath, formatted);
-            std::cout << "Formatted and wrote to " << filepath << std::endl;
-        } else if (command == "debug") {
-            std::cout << "AST =================" << std::endl << tree_to_string(ast.get()) << std::endl;
-            std::cout << "Linting =============" << std::endl << lint_to_json(ast.get()) << std::endl;
-            std::cout << "Formatting ==========" << std::endl << format_tree(ast.get(), fmt_config) << std::endl;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if (arg == "--ndjson") {
+            options.diagnostic_format = DiagnosticFormat::NDJSON;
+        } else if (arg == "--fix") {
+            options.fix = true;
+        } else if (arg == "--optimize") {
+            options.optimize = true;
+        } else if (arg == "--fold") {
+            options.fold = true;
+        } else if (arg == "--edits") {
+            options.edits_only = true;
+        } else if (arg == "--check") {
+            options.check = true;
+        } else if (arg == "--fmt") {
+            options.watch_format = true;
+        } else if (arg == "--stdout") {
+            options.to_stdout = true;
+        } else if (arg == "--stats" || arg == "--stats=json") {
+            options.print_stats = true;
+            options.stats_json = arg == "--stats=json";
+        } else if (arg == "--trace" && i + 1 < argc) {
+            options.trace_path = argv[++i];
+        } else if (arg == "--stream") {
+            options.stream = true;
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            try {
+                options.jobs = std::stoul(argv[++i]);
+            } catch (const std::exception&) {
+                std::cerr << "Invalid job count: " << argv[i] << "\n";
+                return 1;
+            }
+        } else if (arg == "--range" && i + 1 < argc) {
+            std::string range = argv[++i];
+            size_t colon = range.find(':');
+
+            try {
+                options.range_start = std::stoul(range.substr(0, colon));
+                options.range_end = colon == std::string::npos ? options.range_start : std::stoul(range.substr(colon + 1));
+            } catch (const std::exception&) {
+                options.range_start = 0;
+            }
+
+            if (options.range_start == 0 || options.range_end < options.range_start) {
+                std::cerr << "Invalid range: " << range << " (expected L1:L2)\n";
+                return 1;
+            }
+        } else if (arg.rfind("--", 0) == 0) {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        } else {
+            filepaths.push_back(arg);
+        }
+    }
+
+    if (filepaths.empty()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (options.print_stats || !options.trace_path.empty()) {
+        options.stats = &run_stats;
+    }
+    if (!options.trace_path.empty()) {
+        run_stats.set_trace(&trace);
+    }
+
+    // The streaming modes never build the AST that the optimizer rewrites
+    if (options.optimize && (options.stream || options.check || options.range_start > 0)) {
+        std::cerr << "--optimize only works when formatting the whole file\n";
+        return 1;
+    }
+
+    // The streaming formatter has no statement tree to pick lines from
+    if (options.range_start > 0 && options.stream) {
+        std::cerr << "--range cannot be combined with --stream\n";
+        return 1;
+    }
+
+    // --edits describes formatting the whole file instead of writing it
+    if (options.edits_only && (options.stream || options.range_start > 0 || options.check)) {
+        std::cerr << "--edits cannot be combined with --stream, --range or --check\n";
+        return 1;
+    }
+
+    if (options.to_stdout && (options.check || options.edits_only)) {
+        std::cerr << "--stdout cannot be combined with --check or --edits\n";
+        return 1;
+    }
+
+    bool reads_stdin = std::find(filepaths.begin(), filepaths.end(), STDIN_PATH) != filepaths.end();
+    if (reads_stdin && options.fix) {
+        std::cerr << "--fix cannot write back to stdin\n";
+        return 1;
+    }
+
+    if (options.command == "watch") {
+        WatchOptions watch_options;
+        watch_options.format = options.watch_format;
+        watch_options.jobs = options.jobs;
+        watch_options.fmt_config = options.fmt_config;
+
+        std::ios::sync_with_stdio(false);
+        return watch(filepaths, watch_options, std::cout, std::cerr);
+    }
+
+    // Directories are walked for .bf and .b files, honoring ignore files
+    std::vector<std::string> files;
+    std::vector<std::string> directories;
+
+    for (const auto& path: filepaths) {
+        struct stat info;
+        if (stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+            directories.push_back(path);
         } else {
-            std::cerr << "Unknown command: " << command << "\n";
+            files.push_back(path);
+        }
+    }
+
+    if (filepaths.size() > 1 || !directories.empty()) {
+        if (options.command != "lint" && options.command != "fmt") {
+            std::cerr << options.command << " only takes a single file\n";
+            return 1;
+        }
+        if (options.range_start > 0) {
+            std::cerr << "--range only works on a single file\n";
+            return 1;
+        }
+        if (options.to_stdout || reads_stdin) {
+            std::cerr << "stdin and --stdout only work with a single file\n";
             return 1;
         }
+
+        options.batch = true;
+
+        // Files given by name come first, then whatever the walk finds
+        FileWalker walker(options.jobs);
+        walker.start(directories);
+        size_t next_file = 0;
+
+        auto next_path = [&](std::string& path) {
+            if (next_file < files.size()) {
+                path = files[next_file++];
+                return true;
+            }
+            return walker.next(path);
+        };
+
+        ThreadPool pool(options.jobs);
+        int status = run_batch(
+            pool, next_path,
+            [&](const std::string& path) {
+                thread_local Workspace workspace;
+                std::ostringstream out;
+                std::ostringstream err;
+                FileReport report;
+
+                report.status = run_file(options, path, workspace, out, err);
+                report.out = out.str();
+                report.err = err.str();
+                return report;
+            },
+            std::cout, std::cerr);
+
+        for (const auto& error: walker.errors()) {
+            std::cerr << "Error: " << error << "\n";
+            status = 1;
+        }
+        return report_stats(options, trace, status);
+    }
+
+    int status = 1;
+    try {
+        Workspace workspace;
+        status = run_file(options, filepaths.front(), workspace, std::cout, std::cerr);
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << "\n";
-        return 1;
     }
-
-    return 0;
+    return report_stats(options, trace, status);
 }
@@ -0,0 +1,86 @@
+#include "minifier.hpp"
+#include "brainfuck_formatter.hpp"
+
+void Minifier::emit(char c) {
+    output.put(c);
+    output.maybe_flush();
+}
+
+void Minifier::flush_run() {
+    if (run == Run::ARITHMETIC) {
+        char c = net > 0 ? '+' : '-';
+        for (int64_t i = net > 0 ? net : -net; i > 0; --i) {
+            emit(c);
+        }
+    } else if (run == Run::MOVEMENT) {
+        char c = net > 0 ? '>' : '<';
+        for (int64_t i = net > 0 ? net : -net; i > 0; --i) {
+            emit(c);
+        }
+    }
+
+    run = Run::NONE;
+    net = 0;
+}
+
+void Minifier::command(TokenType type) {
+    if (fold) {
+        switch (type) {
+            case TokenType::INCREMENT:
+            case TokenType::DECREMENT:
+                if (run != Run::ARITHMETIC) {
+                    flush_run();
+                    run = Run::ARITHMETIC;
+                }
+                net += type == TokenType::INCREMENT ? 1 : -1;
+                return;
+            case TokenType::MOVE_RIGHT:
+            case TokenType::MOVE_LEFT:
+                if (run != Run::MOVEMENT) {
+                    flush_run();
+                    run = Run::MOVEMENT;
+                }
+                net += type == TokenType::MOVE_RIGHT ? 1 : -1;
+                return;
+            default: flush_run(); break;
+        }
+    }
+
+    switch (type) {
+        case TokenType::MOVE_RIGHT: emit('>'); break;
+        case TokenType::MOVE_LEFT: emit('<'); break;
+        case TokenType::INCREMENT: emit('+'); break;
+        case TokenType::DECREMENT: emit('-'); break;
+        case TokenType::OUTPUT: emit('.'); break;
+        case TokenType::INPUT: emit(','); break;
+        default: break;
+    }
+}
+
+void Minifier::loop_start() {
+    flush_run();
+    emit('[');
+}
+
+void Minifier::loop_end() {
+    flush_run();
+    emit(']');
+}
+
+void Minifier::unmatched_close() {
+    flush_run();
+    emit(']');
+}
+
+void Minifier::finish() {
+    flush_run();
+}
+
+MinifyResult minify_stream(int input_fd, OutputBuffer& output, bool fold) {
+    Minifier minifier(output, fold);
+
+    size_t input_bytes = format_tokens(input_fd, minifier);
+    output.flush();
+
+    return { input_bytes, output.bytes_written() };
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "lexer.hpp"
+#include "output_buffer.hpp"
+#include <cstdint>
+#include <string_view>
+
+// Formatter events in, the densest equivalent command stream out: comments
+// and whitespace are dropped, and with fold enabled every run of +/- and of
+// </> is replaced by its net effect (so "+-" and "<>" disappear entirely).
+class Minifier {
+public:
+    Minifier(OutputBuffer& output, bool fold): output(output), fold(fold) {}
+
+    void command(TokenType type);
+    void comment(std::string_view) {}
+    void loop_start();
+    void loop_end();
+    void unmatched_close();
+    void finish();
+
+    bool is_stopped() const { return output.is_stopped(); }
+
+private:
+    enum class Run { NONE, ARITHMETIC, MOVEMENT };
+
+    void flush_run();
+    void emit(char c);
+
+    OutputBuffer& output;
+    bool fold;
+    Run run = Run::NONE;
+    int64_t net = 0; // positive for + and >, negative for - and <
+};
+
+struct MinifyResult {
+    size_t input_bytes;
+    size_t output_bytes;
+};
+
+// Minify the program read from input_fd in bounded memory, like format_stream
+MinifyResult minify_stream(int input_fd, OutputBuffer& output, bool fold);
@@ -0,0 +1,85 @@
+#include "node_index.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+NodeIndex::NodeIndex(const ProgramNode* root) {
+    if (root != nullptr) {
+        add_statements(root->statements, NONE);
+    }
+}
+
+void NodeIndex::add(const ASTNode* node, EntryKind kind, size_t line, size_t column, uint32_t parent) {
+    if (entries.size() >= NONE) {
+        throw std::length_error("Too many nodes to index");
+    }
+    entries.push_back({ static_cast<uint32_t>(line), static_cast<uint32_t>(column), node, parent, NONE, kind });
+}
+
+// Statements are visited in source order, so the entries come out sorted
+void NodeIndex::add_statements(const std::vector<std::unique_ptr<ASTNode>>& statements, uint32_t parent) {
+    for (const auto& stmt: statements) {
+        if (stmt->type != NodeType::LOOP) {
+            add(stmt.get(), EntryKind::LEAF, stmt->start_line, stmt->start_column, parent);
+            continue;
+        }
+
+        const auto* loop = static_cast<const LoopNode*>(stmt.get());
+        uint32_t open = static_cast<uint32_t>(entries.size());
+
+        add(loop, EntryKind::OPEN, loop->start_line, loop->start_column, parent);
+        add_statements(loop->body, open);
+
+        if (loop->is_terminated) {
+            uint32_t close = static_cast<uint32_t>(entries.size());
+
+            add(loop, EntryKind::CLOSE, loop->end_line, loop->end_column, parent);
+            entries[open].match = close;
+            entries[close].match = open;
+        }
+    }
+}
+
+bool NodeIndex::covers(const Entry& entry, size_t line, size_t column) const {
+    if (entry.kind != EntryKind::LEAF) {
+        return entry.line == line && entry.column == column;
+    }
+
+    // Whitespace runs up to the next node; newline tokens do not carry a
+    // usable end column
+    if (entry.node->type == NodeType::WHITESPACE) {
+        return true;
+    }
+    return line < entry.node->end_line || (line == entry.node->end_line && column <= entry.node->end_column);
+}
+
+NodeLookup NodeIndex::find(size_t line, size_t column) const {
+    NodeLookup result;
+
+    // Last entry starting at or before the position
+    auto after = std::upper_bound(entries.begin(), entries.end(), std::make_pair(line, column), [](const auto& position, const Entry& entry) {
+        return position.first < entry.line || (position.first == entry.line && position.second < entry.column);
+    });
+    if (after == entries.begin()) {
+        return result;
+    }
+
+    const Entry& entry = *(after - 1);
+    uint32_t loop = entry.parent;
+
+    if (covers(entry, line, column)) {
+        result.node = entry.node;
+
+        if (entry.match != NONE) {
+            result.has_match = true;
+            result.match_line = entries[entry.match].line;
+            result.match_column = entries[entry.match].column;
+        }
+    } else if (entry.kind == EntryKind::OPEN) {
+        loop = static_cast<uint32_t>(after - 1 - entries.begin()); // between the '[' and the first statement of its body
+    }
+
+    for (; loop != NONE; loop = entries[loop].parent) {
+        result.loops.push_back(static_cast<const LoopNode*>(entries[loop].node));
+    }
+    return result;
+}
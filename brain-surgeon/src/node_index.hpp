@@ -0,0 +1,48 @@
+#pragma once
+
+#include "parser.hpp"
+#include <cstdint>
+#include <vector>
+
+// Result of a NodeIndex lookup
+struct NodeLookup {
+    const ASTNode* node = nullptr;      // innermost node at the position; the LoopNode on either of its brackets
+    std::vector<const LoopNode*> loops; // loops around the position, innermost first
+    bool has_match = false;             // the position is on a bracket that has a partner
+    size_t match_line = 0;
+    size_t match_column = 0;
+};
+
+// Flat, position-ordered view of an AST for editor queries: finding the node
+// at a position is a binary search, its matching bracket a single step. The
+// index points into the tree, which must outlive it.
+class NodeIndex {
+public:
+    explicit NodeIndex(const ProgramNode* root);
+
+    NodeLookup find(size_t line, size_t column) const;
+
+    size_t size() const { return entries.size(); }
+
+private:
+    enum class EntryKind : uint8_t { LEAF, OPEN, CLOSE };
+
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    // A leaf node or one bracket of a loop. Brackets are single characters,
+    // so only leaves need their node for the end position.
+    struct Entry {
+        uint32_t line;
+        uint32_t column;
+        const ASTNode* node;
+        uint32_t parent; // the OPEN entry of the innermost loop around this one
+        uint32_t match;  // the other bracket of a loop
+        EntryKind kind;
+    };
+
+    std::vector<Entry> entries;
+
+    void add_statements(const std::vector<std::unique_ptr<ASTNode>>& statements, uint32_t parent);
+    void add(const ASTNode* node, EntryKind kind, size_t line, size_t column, uint32_t parent);
+    bool covers(const Entry& entry, size_t line, size_t column) const;
+};
@@ -0,0 +1,110 @@
+#include "optimizer.hpp"
+#include "linter.hpp"
+#include <algorithm>
+#include <vector>
+
+// A command that a following command might still cancel, and whether the
+// current cell was known to be zero before it
+struct PendingCommand {
+    size_t index;
+    bool was_zero;
+};
+
+class Optimizer {
+public:
+    OptimizeStats stats;
+
+    // cell_zero tells whether the current cell is zero when the sequence starts
+    void optimize(std::vector<std::unique_ptr<ASTNode>>& statements, bool cell_zero) {
+        std::vector<PendingCommand> pending;
+
+        for (size_t i = 0; i < statements.size(); ++i) {
+            ASTNode* stmt = statements[i].get();
+
+            switch (stmt->type) {
+                case NodeType::COMMAND: {
+                    auto* cmd = static_cast<CommandNode*>(stmt);
+
+                    // Only trivia or removed nodes can lie between the two
+                    if (!pending.empty() && are_canceling_commands(command_at(statements, pending.back().index), cmd->command)) {
+                        cell_zero = pending.back().was_zero;
+                        statements[pending.back().index].reset();
+                        statements[i].reset();
+                        pending.pop_back();
+                        stats.removed_commands += 2;
+                        break;
+                    }
+
+                    pending.push_back({ i, cell_zero });
+                    cell_zero = false;
+                    break;
+                }
+
+                case NodeType::LOOP: {
+                    auto* loop = static_cast<LoopNode*>(stmt);
+
+                    if (cell_zero && loop->is_terminated) {
+                        statements[i].reset();
+                        stats.removed_loops++;
+                        break;
+                    }
+
+                    // The body runs with a non-zero cell; it is left with a zero one
+                    optimize(loop->body, false);
+                    canonicalize_clear_loop(loop);
+                    loop->analyze_content();
+
+                    pending.clear();
+                    cell_zero = loop->is_terminated;
+                    break;
+                }
+
+                case NodeType::UNMATCHED_CLOSE:
+                    pending.clear();
+                    cell_zero = false;
+                    break;
+
+                default: break;
+            }
+        }
+
+        statements.erase(std::remove(statements.begin(), statements.end(), nullptr), statements.end());
+    }
+
+private:
+    static TokenType command_at(const std::vector<std::unique_ptr<ASTNode>>& statements, size_t index) {
+        return static_cast<const CommandNode*>(statements[index].get())->command;
+    }
+
+    void canonicalize_clear_loop(LoopNode* loop) {
+        CommandNode* only = nullptr;
+
+        for (const auto& stmt: loop->body) {
+            if (stmt->type == NodeType::LOOP || stmt->type == NodeType::UNMATCHED_CLOSE) {
+                return;
+            }
+            if (stmt->type == NodeType::COMMAND) {
+                if (only != nullptr) {
+                    return;
+                }
+                only = static_cast<CommandNode*>(stmt.get());
+            }
+        }
+
+        if (only != nullptr && only->command == TokenType::INCREMENT) {
+            only->command = TokenType::DECREMENT;
+            stats.canonical_loops++;
+        }
+    }
+};
+
+OptimizeStats optimize_tree(ProgramNode* root) {
+    Optimizer optimizer;
+
+    if (root != nullptr) {
+        // All cells start at zero
+        optimizer.optimize(root->statements, true);
+        root->update_end_position();
+    }
+    return optimizer.stats;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "parser.hpp"
+#include <cstddef>
+
+// What optimize_tree changed
+struct OptimizeStats {
+    size_t removed_commands = 0; // canceling +-/<> pairs
+    size_t removed_loops = 0;    // loops entered only when the cell is already zero
+    size_t canonical_loops = 0;  // [+] rewritten as [-]
+};
+
+// Peephole rewrites on the AST that keep the program's behaviour:
+// canceling commands are removed even across whitespace and comments, loops
+// that can never run (at the program start or right after another loop) are
+// dropped, and [+] clear loops are written as [-]. Loop metadata is updated.
+OptimizeStats optimize_tree(ProgramNode* root);
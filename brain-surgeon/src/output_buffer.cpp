@@ -0,0 +1,45 @@
+#include "output_buffer.hpp"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+
+OutputBuffer::OutputBuffer(int fd, size_t chunk_size): fd(fd), chunk_size(chunk_size) {
+    data.resize(chunk_size * 2);
+}
+
+OutputBuffer::OutputBuffer(FlushCallback callback, size_t chunk_size): callback(std::move(callback)), chunk_size(chunk_size) {
+    data.resize(chunk_size * 2);
+}
+
+void OutputBuffer::flush() {
+    if (!has_target() || used == 0) {
+        return;
+    }
+
+    if (!stopped) {
+        if (fd >= 0) {
+            const char* cursor = data.data();
+            size_t remaining = used;
+
+            while (remaining > 0) {
+                ssize_t written = ::write(fd, cursor, remaining);
+
+                if (written < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw std::runtime_error(std::string("Cannot write output: ") + std::strerror(errno));
+                }
+
+                cursor += written;
+                remaining -= static_cast<size_t>(written);
+            }
+        } else if (!callback(buffered())) {
+            stopped = true;
+        }
+    }
+
+    flushed += used;
+    used = 0;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+
+// Byte sink for formatter output. Without a target it simply grows (and can
+// be presized with reserve()), otherwise it hands out full chunks to a file
+// descriptor or a callback so that memory stays bounded by the chunk size.
+class OutputBuffer {
+public:
+    // Receives every flushed chunk; returning false stops the producer early
+    using FlushCallback = std::function<bool(std::string_view chunk)>;
+
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+    OutputBuffer() = default;
+    explicit OutputBuffer(int fd, size_t chunk_size = DEFAULT_CHUNK_SIZE);
+    explicit OutputBuffer(FlushCallback callback, size_t chunk_size = DEFAULT_CHUNK_SIZE);
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    // Capacity only: the bytes are initialised by grow() as output reaches them
+    void reserve(size_t size) { data.reserve(size); }
+
+    // The string is kept at its full capacity and only the first `used` bytes
+    // are output, so the hot write path is a bounds check and a memcpy
+    void put(char c) {
+        if (used == data.size()) {
+            grow(1);
+        }
+        data[used++] = c;
+    }
+
+    void write(const char* text, size_t size) {
+        if (data.size() - used < size) {
+            grow(size);
+        }
+        std::memcpy(&data[used], text, size);
+        used += size;
+    }
+
+    void write(std::string_view text) { write(text.data(), text.size()); }
+
+    // Hand the buffered bytes to the target once a full chunk is collected
+    void maybe_flush() {
+        if (used >= chunk_size && has_target() && !stopped) {
+            flush();
+        }
+    }
+
+    void flush();
+
+    bool is_stopped() const { return stopped; }
+    size_t bytes_written() const { return flushed + used; }
+    std::string_view buffered() const { return std::string_view(data.data(), used); }
+
+    // Move the collected output out of an in-memory buffer
+    std::string take() {
+        data.resize(used);
+        used = 0;
+        return std::move(data);
+    }
+
+private:
+    bool has_target() const { return fd >= 0 || callback != nullptr; }
+    // Doubles the written-to size but stays inside reserved capacity while the
+    // request fits, so a presized buffer never reallocates
+    void grow(size_t size) {
+        size_t target = std::max(data.size() * 2, used + size + 256);
+
+        if (used + size <= data.capacity()) {
+            target = std::min(target, data.capacity());
+        }
+        data.resize(target);
+    }
+
+    std::string data;
+    size_t used = 0;
+    int fd = -1;
+    FlushCallback callback;
+    size_t chunk_size = DEFAULT_CHUNK_SIZE;
+    size_t flushed = 0;
+    bool stopped = false;
+};
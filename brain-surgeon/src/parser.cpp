@@ -2,53 +2,77 @@
 #include <iostream>
 #include <sstream>
 
-std::unique_ptr<ProgramNode> BrainfuckParser::parse(const std::vector<Token>& token_list) {
+std::unique_ptr<ProgramNode> BrainfuckParser::parse(const std::vector<Token>& token_list, ParseMode parse_mode) {
     current = 0;
-    tokens = token_list;
+    tokens = token_list.data();
+    token_count = token_list.size();
+    mode = parse_mode;
+    after_whitespace = false;
 
     auto program = std::make_unique<ProgramNode>();
 
-    while (current < tokens.size()) {
+    while (current < token_count) {
         auto stmt = parse_statement();
 
         if (stmt) {
             program->statements.push_back(std::move(stmt));
+        } else {
+            program->has_dropped_whitespace = true;
         }
     }
 
     program->update_end_position();
+
+    tokens = nullptr;
+    token_count = 0;
     return program;
 }
 
 std::unique_ptr<ASTNode> BrainfuckParser::parse_statement() {
-    if (current >= tokens.size()) {
+    if (current >= token_count) {
         return nullptr;
     }
 
     const Token& token = tokens[current];
+    bool is_whitespace = token.type == TokenType::WHITESPACE || token.type == TokenType::NEWLINE;
+
+    // Whitespace only separates statements, so a flag on the next node keeps
+    // everything the linter checks
+    if (is_whitespace && mode == ParseMode::TRIVIA_FREE) {
+        while (current < token_count && (tokens[current].type == TokenType::WHITESPACE || tokens[current].type == TokenType::NEWLINE)) {
+            current++;
+        }
+        after_whitespace = true;
+        return nullptr;
+    }
+
+    bool follows_whitespace = after_whitespace;
+    after_whitespace = false;
+
+    std::unique_ptr<ASTNode> node;
 
     switch (token.type) {
         case TokenType::WHITESPACE:
-        case TokenType::NEWLINE: return parse_whitespace_sequence();
-        case TokenType::COMMENT: return parse_comment_sequence();
-        case TokenType::LOOP_START: return parse_loop();
-        case TokenType::LOOP_END: {
-            auto unmatched = std::make_unique<UnmatchedCloseNode>(token.start_line, token.start_column, token.end_line, token.end_column);
+        case TokenType::NEWLINE: node = parse_whitespace_sequence(); break;
+        case TokenType::COMMENT: node = parse_comment_sequence(); break;
+        case TokenType::LOOP_START: node = parse_loop(); break;
+        case TokenType::LOOP_END:
+            node = std::make_unique<UnmatchedCloseNode>(token.start_line, token.start_column, token.end_line, token.end_column);
             current++;
-
-            return unmatched;
-        }
+            break;
 
         default:
-            auto cmd = std::make_unique<CommandNode>(token.type, token.start_line, token.start_column, token.end_line, token.end_column);
+            node = std::make_unique<CommandNode>(token.type, token.start_line, token.start_column, token.end_line, token.end_column);
             current++;
-
-            return cmd;
+            break;
     }
+
+    node->follows_whitespace = follows_whitespace;
+    return node;
 }
 
 std::unique_ptr<LoopNode> BrainfuckParser::parse_loop() {
-    if (current >= tokens.size() || tokens[current].type != TokenType::LOOP_START) {
+    if (current >= token_count || tokens[current].type != TokenType::LOOP_START) {
         return nullptr;
     }
 
@@ -57,7 +81,7 @@ std::unique_ptr<LoopNode> BrainfuckParser::parse_loop() {
 
     auto loop = std::make_unique<LoopNode>(start_token.start_line, start_token.start_column, start_token.end_line, start_token.end_column);
 
-    while (current < tokens.size() && tokens[current].type != TokenType::LOOP_END) {
+    while (current < token_count && tokens[current].type != TokenType::LOOP_END) {
         auto stmt = parse_statement();
 
         if (stmt) {
@@ -65,26 +89,29 @@ std::unique_ptr<LoopNode> BrainfuckParser::parse_loop() {
         }
     }
 
-    if (current < tokens.size() && tokens[current].type == TokenType::LOOP_END) {
+    if (current < token_count && tokens[current].type == TokenType::LOOP_END) {
         const Token& end_token = tokens[current];
         loop->update_end_position(end_token.end_line, end_token.end_column);
         current++;
     }
 
+    // Whitespace before the ']' does not separate the loop from what follows
+    after_whitespace = false;
+
     loop->analyze_content();
 
     return loop;
 }
 
 std::unique_ptr<WhitespaceNode> BrainfuckParser::parse_whitespace_sequence() {
-    if (current >= tokens.size()) {
+    if (current >= token_count) {
         return nullptr;
     }
 
     const Token& first_token = tokens[current];
     std::string combined_text;
 
-    while (current < tokens.size() && (tokens[current].type == TokenType::WHITESPACE || tokens[current].type == TokenType::NEWLINE)) {
+    while (current < token_count && (tokens[current].type == TokenType::WHITESPACE || tokens[current].type == TokenType::NEWLINE)) {
         combined_text += tokens[current].text;
         current++;
     }
@@ -95,7 +122,7 @@ std::unique_ptr<WhitespaceNode> BrainfuckParser::parse_whitespace_sequence() {
 }
 
 std::unique_ptr<CommentNode> BrainfuckParser::parse_comment_sequence() {
-    if (current >= tokens.size() || tokens[current].type != TokenType::COMMENT) {
+    if (current >= token_count || tokens[current].type != TokenType::COMMENT) {
         return nullptr;
     }
 
@@ -103,8 +130,10 @@ std::unique_ptr<CommentNode> BrainfuckParser::parse_comment_sequence() {
     std::string combined_text;
     size_t current_line = first_token.start_line;
 
-    while (current < tokens.size() && tokens[current].type == TokenType::COMMENT && tokens[current].start_line == current_line) {
-        combined_text += tokens[current].text;
+    while (current < token_count && tokens[current].type == TokenType::COMMENT && tokens[current].start_line == current_line) {
+        if (mode == ParseMode::FULL) {
+            combined_text += tokens[current].text;
+        }
         current++;
     }
 
@@ -1,15 +1,21 @@
 #pragma once
 
 #include "lexer.hpp"
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
 
 enum class NodeType { PROGRAM, COMMAND, LOOP, WHITESPACE, COMMENT, UNMATCHED_CLOSE };
 
+// TRIVIA_FREE leaves whitespace out of the tree and the text out of comments,
+// which is all the linter needs; the formatter needs a FULL tree
+enum class ParseMode { FULL, TRIVIA_FREE };
+
 class ASTNode {
 public:
     NodeType type;
+    bool follows_whitespace = false; // only set by TRIVIA_FREE parses, instead of a WhitespaceNode
     size_t start_line;
     size_t start_column;
     size_t end_line;
@@ -22,6 +28,7 @@ public:
 class ProgramNode: public ASTNode {
 public:
     std::vector<std::unique_ptr<ASTNode>> statements;
+    bool has_dropped_whitespace = false; // a TRIVIA_FREE parse of a non-empty file can have no statements
 
     ProgramNode(): ASTNode(NodeType::PROGRAM) {}
 
@@ -41,19 +48,42 @@ public:
     explicit CommandNode(TokenType cmd, size_t sl = 0, size_t sc = 0, size_t el = 0, size_t ec = 0): ASTNode(NodeType::COMMAND, sl, sc, el, ec), command(cmd) {}
 };
 
+class WhitespaceNode: public ASTNode {
+public:
+    std::string text;
+
+    explicit WhitespaceNode(const std::string& t, size_t sl = 0, size_t sc = 0, size_t el = 0, size_t ec = 0): ASTNode(NodeType::WHITESPACE, sl, sc, el, ec), text(t) {}
+};
+
+class CommentNode: public ASTNode {
+public:
+    std::string text;
+
+    explicit CommentNode(const std::string& t, size_t sl = 0, size_t sc = 0, size_t el = 0, size_t ec = 0): ASTNode(NodeType::COMMENT, sl, sc, el, ec), text(t) {}
+};
+
+// FNV-1a step used for the structural hashes of loops
+inline uint64_t mix_hash(uint64_t hash, uint64_t value) {
+    return (hash ^ value) * 1099511628211ull;
+}
+
 class LoopNode: public ASTNode {
 public:
     std::vector<std::unique_ptr<ASTNode>> body;
     bool is_empty;             // Contains no valid commands
     bool is_terminated;        // Has matching ']'
     bool has_single_statement; // Contains exactly one valid command
+    uint64_t structure_hash;   // Hash of the commands, comments and nested loops (not whitespace)
+    size_t subtree_size;       // Number of commands, comments and loops including this one
 
     explicit LoopNode(size_t sl = 0, size_t sc = 0, size_t el = 0, size_t ec = 0):
         ASTNode(NodeType::LOOP, sl, sc, el, ec),
 
         is_empty(true),
         is_terminated(false),
-        has_single_statement(false) {}
+        has_single_statement(false),
+        structure_hash(0),
+        subtree_size(1) {}
 
     void update_end_position(size_t el, size_t ec) {
         end_line = el;
@@ -64,6 +94,9 @@ public:
     void analyze_content() {
         size_t command_count = 0;
 
+        structure_hash = 14695981039346656037ull;
+        subtree_size = 1;
+
         for (const auto& stmt: body) {
             if (stmt->type == NodeType::COMMAND) {
                 auto* cmd = static_cast<CommandNode*>(stmt.get());
@@ -71,6 +104,22 @@ public:
                 if (cmd->command != TokenType::LOOP_START && cmd->command != TokenType::LOOP_END) {
                     command_count++;
                 }
+
+                structure_hash = mix_hash(structure_hash, static_cast<uint64_t>(cmd->command));
+                subtree_size++;
+            } else if (stmt->type == NodeType::LOOP) {
+                auto* loop = static_cast<LoopNode*>(stmt.get());
+
+                structure_hash = mix_hash(mix_hash(structure_hash, static_cast<uint64_t>(TokenType::LOOP_START)), loop->structure_hash);
+                subtree_size += loop->subtree_size;
+            } else if (stmt->type == NodeType::COMMENT) {
+                const std::string& text = static_cast<CommentNode*>(stmt.get())->text;
+
+                structure_hash = mix_hash(mix_hash(structure_hash, static_cast<uint64_t>(TokenType::COMMENT)), text.size());
+                for (char c: text) {
+                    structure_hash = mix_hash(structure_hash, static_cast<unsigned char>(c));
+                }
+                subtree_size++;
             }
         }
 
@@ -79,29 +128,21 @@ public:
     }
 };
 
-class WhitespaceNode: public ASTNode {
-public:
-    std::string text;
-
-    explicit WhitespaceNode(const std::string& t, size_t sl = 0, size_t sc = 0, size_t el = 0, size_t ec = 0): ASTNode(NodeType::WHITESPACE, sl, sc, el, ec), text(t) {}
-};
-
-class CommentNode: public ASTNode {
-public:
-    std::string text;
-
-    explicit CommentNode(const std::string& t, size_t sl = 0, size_t sc = 0, size_t el = 0, size_t ec = 0): ASTNode(NodeType::COMMENT, sl, sc, el, ec), text(t) {}
-};
-
 class UnmatchedCloseNode: public ASTNode {
 public:
     explicit UnmatchedCloseNode(size_t sl = 0, size_t sc = 0, size_t el = 0, size_t ec = 0): ASTNode(NodeType::UNMATCHED_CLOSE, sl, sc, el, ec) {}
 };
 
+// Keeps no state between calls to parse(), so one parser per thread can be
+// reused for any number of files
 class BrainfuckParser {
 private:
-    std::vector<Token> tokens;
-    size_t current;
+    // The tokens are only borrowed for the duration of parse()
+    const Token* tokens = nullptr;
+    size_t token_count = 0;
+    size_t current = 0;
+    ParseMode mode = ParseMode::FULL;
+    bool after_whitespace = false; // whitespace was skipped since the last node
 
     std::unique_ptr<LoopNode> parse_loop();
     std::unique_ptr<ASTNode> parse_statement();
@@ -109,7 +150,7 @@ private:
     std::unique_ptr<WhitespaceNode> parse_whitespace_sequence();
 
 public:
-    std::unique_ptr<ProgramNode> parse(const std::vector<Token>& token_list);
+    std::unique_ptr<ProgramNode> parse(const std::vector<Token>& token_list, ParseMode parse_mode = ParseMode::FULL);
 
 private:
     std::string get_token_name(TokenType type) const;
@@ -0,0 +1,142 @@
+#include "piece_table.hpp"
+#include <algorithm>
+
+static size_t count_newlines(std::string_view text) {
+    return static_cast<size_t>(std::count(text.begin(), text.end(), '\n'));
+}
+
+// UTF-16 code units of the character a UTF-8 byte starts (0 for continuations)
+static size_t utf16_units(unsigned char byte) {
+    if ((byte & 0xC0) == 0x80) {
+        return 0;
+    }
+    return byte >= 0xF0 ? 2 : 1;
+}
+
+PieceTable::PieceTable(std::string text): original(std::move(text)), length(original.size()) {
+    if (!original.empty()) {
+        pieces.push_back({ false, 0, original.size(), count_newlines(original) });
+    }
+}
+
+std::string_view PieceTable::piece_text(const Piece& piece) const {
+    const std::string& buffer = piece.in_added ? added : original;
+    return std::string_view(buffer).substr(piece.start, piece.length);
+}
+
+// Make sure a piece starts at offset and return its index
+size_t PieceTable::split(size_t offset) {
+    size_t position = 0;
+
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        if (position == offset) {
+            return i;
+        }
+
+        Piece& piece = pieces[i];
+        if (offset < position + piece.length) {
+            size_t head = offset - position;
+            size_t head_newlines = count_newlines(piece_text(piece).substr(0, head));
+            Piece tail { piece.in_added, piece.start + head, piece.length - head, piece.newlines - head_newlines };
+
+            piece.length = head;
+            piece.newlines = head_newlines;
+            pieces.insert(pieces.begin() + static_cast<std::ptrdiff_t>(i) + 1, tail);
+            return i + 1;
+        }
+        position += piece.length;
+    }
+
+    return pieces.size();
+}
+
+void PieceTable::replace(size_t start, size_t end, std::string_view text) {
+    start = std::min(start, length);
+    end = std::clamp(end, start, length);
+
+    size_t first = split(start);
+    size_t last = split(end);
+
+    pieces.erase(pieces.begin() + static_cast<std::ptrdiff_t>(first), pieces.begin() + static_cast<std::ptrdiff_t>(last));
+    length -= end - start;
+
+    if (!text.empty()) {
+        // Text typed right after the previous insertion extends its piece
+        if (first > 0 && pieces[first - 1].in_added && pieces[first - 1].start + pieces[first - 1].length == added.size()) {
+            pieces[first - 1].length += text.size();
+            pieces[first - 1].newlines += count_newlines(text);
+        } else {
+            pieces.insert(pieces.begin() + static_cast<std::ptrdiff_t>(first), Piece { true, added.size(), text.size(), count_newlines(text) });
+        }
+
+        added.append(text.data(), text.size());
+        length += text.size();
+    }
+
+    if (pieces.size() > MAX_PIECES) {
+        compact();
+    }
+}
+
+void PieceTable::compact() {
+    original = text();
+    added.clear();
+    pieces.clear();
+
+    if (!original.empty()) {
+        pieces.push_back({ false, 0, original.size(), count_newlines(original) });
+    }
+}
+
+size_t PieceTable::offset(size_t line, size_t character) const {
+    size_t position = 0;
+
+    for (const auto& piece: pieces) {
+        std::string_view text = piece_text(piece);
+
+        if (line > 0) {
+            // Skip whole pieces until the one the line starts in
+            if (piece.newlines < line) {
+                line -= piece.newlines;
+                position += piece.length;
+                continue;
+            }
+
+            size_t line_start = 0;
+            for (; line > 0; --line) {
+                line_start = text.find('\n', line_start) + 1;
+            }
+            position += line_start;
+            text.remove_prefix(line_start);
+        }
+
+        for (char c: text) {
+            size_t units = utf16_units(static_cast<unsigned char>(c));
+
+            // Stop at the end of the line or before the next character,
+            // never inside the bytes of a multi-byte one
+            if (c == '\n' || (character == 0 && units > 0)) {
+                return position;
+            }
+            character -= std::min(character, units);
+            position++;
+        }
+    }
+
+    return position;
+}
+
+void PieceTable::copy_to(std::string& out) const {
+    out.clear();
+    out.reserve(length);
+
+    for (const auto& piece: pieces) {
+        out.append(piece_text(piece));
+    }
+}
+
+std::string PieceTable::text() const {
+    std::string result;
+    copy_to(result);
+    return result;
+}
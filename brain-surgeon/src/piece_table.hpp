@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Editable text that never copies the whole buffer on an edit: the text is a
+// list of pieces of the original buffer and of an append-only buffer of
+// inserted text. Typing at one place keeps growing the same piece.
+class PieceTable {
+public:
+    explicit PieceTable(std::string text = "");
+
+    // Replace the bytes [start, end) with text
+    void replace(size_t start, size_t end, std::string_view text);
+
+    size_t size() const { return length; }
+
+    // Byte offset of a 0-based line and a column counted in UTF-16 code units,
+    // as used by LSP positions; clamped to the end of the line and the text
+    size_t offset(size_t line, size_t character) const;
+
+    // Write the current text into out, reusing its memory
+    void copy_to(std::string& out) const;
+    std::string text() const;
+
+private:
+    struct Piece {
+        bool in_added; // from the added buffer, otherwise from the original
+        size_t start;
+        size_t length;
+        size_t newlines;
+    };
+
+    // Edits only ever add pieces; past this many they are merged into one
+    static constexpr size_t MAX_PIECES = 4096;
+
+    std::string_view piece_text(const Piece& piece) const;
+    size_t split(size_t offset);
+    void compact();
+
+    std::string original;
+    std::string added;
+    std::vector<Piece> pieces;
+    size_t length = 0;
+};
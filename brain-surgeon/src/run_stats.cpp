@@ -0,0 +1,107 @@
+#include "run_stats.hpp"
+#include "../include/json.hpp"
+#include <iomanip>
+#include <sys/resource.h>
+#include <vector>
+
+using json = nlohmann::json;
+
+static const char* phase_name(size_t phase) {
+    static const char* const names[PHASE_COUNT] = { "read", "tokenize", "parse", "optimize", "lint", "format", "output" };
+    return names[phase];
+}
+
+void RunStats::record(Phase phase, std::chrono::steady_clock::time_point phase_start, std::chrono::steady_clock::time_point phase_end, size_t bytes) {
+    PhaseTotals& totals = phases[static_cast<size_t>(phase)];
+
+    totals.nanoseconds += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(phase_end - phase_start).count());
+    totals.bytes += bytes;
+    totals.count++;
+
+    if (trace != nullptr) {
+        trace->span(phase_name(static_cast<size_t>(phase)), phase_start, phase_end);
+    }
+}
+
+void RunStats::add_file(const std::string& file) {
+    files++;
+    if (trace != nullptr) {
+        trace->begin_file(file);
+    }
+}
+
+void RunStats::add_tree(const ProgramNode* root) {
+    if (root == nullptr) {
+        return;
+    }
+
+    // Explicit stack, deeply nested programs must not overflow the call stack
+    std::vector<std::pair<const std::vector<std::unique_ptr<ASTNode>>*, size_t>> pending { { &root->statements, 0 } };
+    uint64_t count = 0;
+    uint64_t deepest = 0;
+
+    while (!pending.empty()) {
+        auto [statements, depth] = pending.back();
+        pending.pop_back();
+        deepest = std::max<uint64_t>(deepest, depth);
+
+        for (const auto& stmt: *statements) {
+            count++;
+            if (stmt->type == NodeType::LOOP) {
+                pending.push_back({ &static_cast<const LoopNode*>(stmt.get())->body, depth + 1 });
+            }
+        }
+    }
+
+    nodes += count;
+    uint64_t seen = max_depth.load();
+    while (seen < deepest && !max_depth.compare_exchange_weak(seen, deepest)) {
+    }
+}
+
+// Peak resident set size of the process in KiB
+static long peak_rss_kb() {
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+static double megabytes_per_second(uint64_t bytes, uint64_t nanoseconds) {
+    return nanoseconds == 0 ? 0.0 : static_cast<double>(bytes) * 1e3 / static_cast<double>(nanoseconds);
+}
+
+void RunStats::write(std::ostream& out, bool as_json) const {
+    double wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if (as_json) {
+        json result = { { "wallMs", wall_ms }, { "files", files.load() },         { "tokens", tokens.load() },
+                        { "nodes", nodes.load() }, { "maxDepth", max_depth.load() }, { "peakRssKb", peak_rss_kb() } };
+        json by_phase = json::object();
+
+        for (size_t i = 0; i < PHASE_COUNT; ++i) {
+            const PhaseTotals& totals = phases[i];
+            if (totals.count == 0) {
+                continue;
+            }
+            by_phase[phase_name(i)] = { { "ms", static_cast<double>(totals.nanoseconds) / 1e6 },
+                                        { "bytes", totals.bytes.load() },
+                                        { "mbPerSecond", megabytes_per_second(totals.bytes, totals.nanoseconds) } };
+        }
+        result["phases"] = by_phase;
+        out << result.dump() << "\n";
+        return;
+    }
+
+    out << std::fixed << std::setprecision(3);
+    out << "Phase          Time (ms)        MB/s\n";
+    for (size_t i = 0; i < PHASE_COUNT; ++i) {
+        const PhaseTotals& totals = phases[i];
+        if (totals.count == 0) {
+            continue;
+        }
+        out << std::left << std::setw(10) << phase_name(i) << std::right << std::setw(14) << static_cast<double>(totals.nanoseconds) / 1e6 << std::setw(12)
+            << std::setprecision(1) << megabytes_per_second(totals.bytes, totals.nanoseconds) << std::setprecision(3) << "\n";
+    }
+    out << "Wall time: " << wall_ms << " ms, peak RSS: " << peak_rss_kb() << " KiB\n";
+    out << "Files: " << files << ", tokens: " << tokens << ", nodes: " << nodes << ", max depth: " << max_depth << "\n";
+    out << std::defaultfloat;
+}
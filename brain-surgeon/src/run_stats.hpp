@@ -0,0 +1,104 @@
+#pragma once
+
+#include "parser.hpp"
+#include "trace.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// The phases --stats reports on, in the order they happen
+enum class Phase { READ, TOKENIZE, PARSE, OPTIMIZE, LINT, FORMAT, OUTPUT };
+
+constexpr size_t PHASE_COUNT = 7;
+
+// Time spent and bytes processed per phase, summed over every file of a run.
+// Counters are atomic, so the threads of a batch can all record into one.
+// With a TraceRecorder every phase also becomes a span of the trace.
+class RunStats {
+public:
+    RunStats(): start(std::chrono::steady_clock::now()) {}
+
+    void record(Phase phase, std::chrono::steady_clock::time_point phase_start, std::chrono::steady_clock::time_point phase_end, size_t bytes);
+
+    void set_trace(TraceRecorder* recorder) { trace = recorder; }
+    TraceRecorder* tracer() const { return trace; }
+
+    // Count the tokens of a file and the nodes and nesting depth of its AST
+    void add_tokens(size_t count) { tokens += count; }
+    void add_tree(const ProgramNode* root);
+    void add_file(const std::string& file);
+
+    // Human readable table, or a single JSON object
+    void write(std::ostream& out, bool as_json) const;
+
+private:
+    struct PhaseTotals {
+        std::atomic<uint64_t> nanoseconds { 0 };
+        std::atomic<uint64_t> bytes { 0 };
+        std::atomic<uint64_t> count { 0 };
+    };
+
+    std::chrono::steady_clock::time_point start;
+    PhaseTotals phases[PHASE_COUNT];
+    std::atomic<uint64_t> files { 0 };
+    std::atomic<uint64_t> tokens { 0 };
+    std::atomic<uint64_t> nodes { 0 };
+    std::atomic<uint64_t> max_depth { 0 };
+    TraceRecorder* trace = nullptr;
+};
+
+// Records the time from construction to destruction as one phase; does
+// nothing, not even read the clock, without stats
+class PhaseTimer {
+public:
+    PhaseTimer(RunStats* stats, Phase phase, size_t bytes = 0): stats(stats), phase(phase), bytes(bytes) {
+        if (stats != nullptr) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+    ~PhaseTimer() {
+        if (stats != nullptr) {
+            stats->record(phase, start, std::chrono::steady_clock::now(), bytes);
+        }
+    }
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+    // End the phase early, once its size is known
+    void finish(size_t count) {
+        bytes = count;
+        if (stats != nullptr) {
+            stats->record(phase, start, std::chrono::steady_clock::now(), bytes);
+            stats = nullptr;
+        }
+    }
+
+private:
+    RunStats* stats;
+    Phase phase;
+    size_t bytes;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Counts a file and, when tracing, groups its phases under one span
+class FileScope {
+public:
+    FileScope(RunStats* stats, const std::string& file): stats(stats) {
+        if (stats != nullptr) {
+            stats->add_file(file);
+        }
+    }
+    ~FileScope() {
+        if (stats != nullptr && stats->tracer() != nullptr) {
+            stats->tracer()->end_file();
+        }
+    }
+
+    FileScope(const FileScope&) = delete;
+    FileScope& operator=(const FileScope&) = delete;
+
+private:
+    RunStats* stats;
+};
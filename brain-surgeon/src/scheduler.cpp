@@ -0,0 +1,124 @@
+#include "scheduler.hpp"
+#include <exception>
+
+Scheduler::Scheduler(): worker([this]() { run(); }) {}
+
+Scheduler::~Scheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+
+        if (running.token != nullptr) {
+            running.token->cancel();
+        }
+    }
+    changed.notify_all();
+    worker.join();
+
+    for (auto& [key, waiting]: pending) {
+        if (waiting.job.on_cancel) {
+            waiting.job.on_cancel();
+        }
+    }
+}
+
+void Scheduler::schedule(const std::string& key, Job job) {
+    std::function<void()> replaced;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Clock::time_point due = Clock::now() + job.delay;
+        auto found = pending.find(key);
+
+        if (found != pending.end()) {
+            replaced = std::move(found->second.job.on_cancel);
+            found->second = { std::move(job), due };
+        } else {
+            pending.emplace(key, Pending { std::move(job), due });
+        }
+
+        if (running.key == key && running.token != nullptr) {
+            running.token->cancel();
+        }
+    }
+    changed.notify_all();
+
+    if (replaced) {
+        replaced();
+    }
+}
+
+void Scheduler::cancel(const std::string& key) {
+    std::function<void()> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = pending.find(key);
+
+        if (found != pending.end()) {
+            dropped = std::move(found->second.job.on_cancel);
+            pending.erase(found);
+        }
+        if (running.key == key && running.token != nullptr) {
+            running.token->cancel();
+        }
+    }
+
+    if (dropped) {
+        dropped();
+    }
+}
+
+void Scheduler::drain() {
+    std::unique_lock<std::mutex> lock(mutex);
+    draining = true;
+    changed.notify_all();
+
+    idle.wait(lock, [this]() { return pending.empty() && running.token == nullptr; });
+    draining = false;
+}
+
+void Scheduler::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (!stopping) {
+        if (pending.empty()) {
+            changed.wait(lock);
+            continue;
+        }
+
+        // The job that is due first; newer jobs may arrive while waiting
+        auto next = pending.begin();
+        for (auto it = pending.begin(); it != pending.end(); ++it) {
+            if (it->second.due < next->second.due) {
+                next = it;
+            }
+        }
+        if (!draining && next->second.due > Clock::now()) {
+            changed.wait_until(lock, next->second.due);
+            continue;
+        }
+
+        Job job = std::move(next->second.job);
+        auto token = std::make_shared<CancellationToken>();
+        running = { next->first, token };
+        pending.erase(next);
+
+        lock.unlock();
+        bool finished = true;
+        try {
+            job.run(*token);
+        } catch (const OperationCancelled&) {
+            finished = false;
+        } catch (const std::exception&) {
+            // Jobs report their own errors; one failing must not stop the others
+        }
+        if (!finished && job.on_cancel) {
+            job.on_cancel();
+        }
+        lock.lock();
+
+        running = {};
+        if (pending.empty()) {
+            idle.notify_all();
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "cancellation.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Runs jobs on a background thread, at most one per key: scheduling a job
+// replaces the one still waiting under the same key (so a burst of requests
+// runs once, for the latest state) and cancels the one already running
+// through its token. Every job waits out its delay before it starts.
+class Scheduler {
+public:
+    struct Job {
+        std::function<void(const CancellationToken&)> run;
+        std::function<void()> on_cancel; // when replaced or cancelled before it finished
+        std::chrono::milliseconds delay { 0 };
+    };
+
+    Scheduler();
+    ~Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    void schedule(const std::string& key, Job job);
+
+    // Drop the waiting job and cancel the running one for key, if any
+    void cancel(const std::string& key);
+
+    // Run every waiting job now, without its delay, and return once none is
+    // left, so that shutting down answers requests instead of cancelling them
+    void drain();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Pending {
+        Job job;
+        Clock::time_point due;
+    };
+
+    struct Running {
+        std::string key;
+        std::shared_ptr<CancellationToken> token;
+    };
+
+    void run();
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::condition_variable idle; // no job waiting or running
+    std::map<std::string, Pending> pending;
+    Running running;
+    bool stopping = false;
+    bool draining = false;
+    std::thread worker;
+};
@@ -0,0 +1,255 @@
+#include "server.hpp"
+#include "file_io.hpp"
+#include "format_cache.hpp"
+#include "formatter.hpp"
+#include "json_rpc.hpp"
+#include "linter.hpp"
+#include "node_index.hpp"
+#include "parser.hpp"
+#include "source.hpp"
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// A document held by the server, parsed on first use after every change
+struct Document {
+    std::string text;
+    int64_t version = 0;
+    std::unique_ptr<ProgramNode> ast;
+    std::unique_ptr<NodeIndex> index; // built on the first position query
+};
+
+static json diagnostic_to_json(const LintDiagnostic& diagnostic) {
+    return { { "startLine", diagnostic.start_line }, { "startColumn", diagnostic.start_column }, { "endLine", diagnostic.end_line },
+             { "endColumn", diagnostic.end_column }, { "message", diagnostic.message },         { "level", level_to_string(diagnostic.severity) } };
+}
+
+static const char* node_type_name(NodeType type) {
+    switch (type) {
+        case NodeType::COMMAND: return "command";
+        case NodeType::LOOP: return "loop";
+        case NodeType::WHITESPACE: return "whitespace";
+        case NodeType::COMMENT: return "comment";
+        case NodeType::UNMATCHED_CLOSE: return "unmatched_close";
+        default: return "program";
+    }
+}
+
+static json node_range_to_json(const ASTNode* node) {
+    return { { "startLine", node->start_line }, { "startColumn", node->start_column }, { "endLine", node->end_line }, { "endColumn", node->end_column } };
+}
+
+// Same positions as fmt --edits: 1-based, with an exclusive end
+static json edit_to_json(const TextEdit& edit, const LineIndex& lines) {
+    size_t start_line = lines.line_of(edit.start_offset);
+    size_t end_line = lines.line_of(edit.end_offset);
+
+    return { { "startLine", start_line },
+             { "startColumn", edit.start_offset - lines.line_start(start_line) + 1 },
+             { "endLine", end_line },
+             { "endColumn", edit.end_offset - lines.line_start(end_line) + 1 },
+             { "newText", edit.replacement } };
+}
+
+class Server {
+public:
+    Server(std::istream& in, std::ostream& out): in(in), out(out) {}
+
+    int run() {
+        std::string line;
+
+        while (!stopping && std::getline(in, line)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+            handle_message(line);
+        }
+        return 0;
+    }
+
+private:
+    std::istream& in;
+    std::ostream& out;
+    bool stopping = false;
+
+    std::unordered_map<std::string, Document> documents;
+    BrainfuckLexer lexer;
+    BrainfuckParser parser;
+    std::vector<Token> tokens;
+    FormatterConfig fmt_config;
+    FormatCache cache;
+
+    void send(const json& message) {
+        out << message.dump() << '\n';
+        out.flush();
+    }
+
+    void send_error(const json& id, int code, const std::string& message) { send(rpc_error(id, code, message)); }
+
+    void handle_message(const std::string& line) {
+        json message = json::parse(line, nullptr, false);
+
+        if (message.is_discarded()) {
+            send_error(nullptr, PARSE_ERROR, "Parse error");
+            return;
+        }
+        if (!message.is_object() || !message.contains("method") || !message["method"].is_string()) {
+            send_error(message.is_object() && message.contains("id") ? message["id"] : json(nullptr), INVALID_REQUEST, "Invalid request");
+            return;
+        }
+
+        // Requests without an id are notifications and get no response
+        bool is_notification = !message.contains("id");
+        json id = is_notification ? json(nullptr) : message["id"];
+
+        try {
+            json result = call(message["method"].get<std::string>(), message.value("params", json::object()));
+
+            if (!is_notification) {
+                send(rpc_result(id, std::move(result)));
+            }
+        } catch (const RpcError& e) {
+            if (!is_notification) {
+                send_error(id, e.code, e.what());
+            }
+        } catch (const json::exception& e) {
+            if (!is_notification) {
+                send_error(id, INVALID_PARAMS, e.what());
+            }
+        } catch (const std::exception& e) {
+            if (!is_notification) {
+                send_error(id, INTERNAL_ERROR, e.what());
+            }
+        }
+    }
+
+    json call(const std::string& method, const json& params) {
+        if (method == "open" || method == "change") {
+            Document& doc = document(params);
+            return { { "version", doc.version } };
+        }
+        if (method == "close") {
+            documents.erase(params.at("path").get<std::string>());
+            return nullptr;
+        }
+        if (method == "lint") {
+            return lint(document(params));
+        }
+        if (method == "format") {
+            return format(params.at("path").get<std::string>(), document(params), params.value("write", false));
+        }
+        if (method == "node") {
+            return node_at(document(params), params.at("line").get<size_t>(), params.at("column").get<size_t>());
+        }
+        if (method == "debug") {
+            Document& doc = document(params);
+            return { { "ast", tree_to_string(ast(doc)) }, { "diagnostics", lint(doc) }, { "formatted", format_tree(ast(doc), fmt_config, cache) } };
+        }
+        if (method == "shutdown") {
+            stopping = true;
+            return nullptr;
+        }
+
+        throw RpcError(METHOD_NOT_FOUND, "Method not found: " + method);
+    }
+
+    // The document named by params, updated with its text if given and read
+    // from disk if the server has not seen it before
+    Document& document(const json& params) {
+        if (!params.is_object() || !params.contains("path")) {
+            throw RpcError(INVALID_PARAMS, "Missing path");
+        }
+
+        std::string path = params["path"].get<std::string>();
+        auto found = documents.find(path);
+
+        // A request made for a version that was replaced since then would
+        // return results for text the client no longer has
+        if (found != documents.end() && params.contains("version") && params["version"].get<int64_t>() < found->second.version) {
+            throw RpcError(CONTENT_MODIFIED, "Content modified");
+        }
+
+        if (params.contains("text")) {
+            Document& doc = documents[path];
+            doc.text = params["text"].get<std::string>();
+            doc.version = params.value("version", doc.version + 1);
+            doc.ast.reset();
+            doc.index.reset();
+            return doc;
+        }
+
+        if (found == documents.end()) {
+            Document& doc = documents[path];
+            doc.text = read_file(path);
+            doc.version = params.value("version", int64_t(1));
+            return doc;
+        }
+        return found->second;
+    }
+
+    const ProgramNode* ast(Document& doc) {
+        if (doc.ast == nullptr) {
+            lexer.tokenize(doc.text, tokens);
+            doc.ast = parser.parse(tokens);
+        }
+        return doc.ast.get();
+    }
+
+    // The innermost node at a 1-based line and column, the loops around it and
+    // the bracket matching the one under the cursor
+    json node_at(Document& doc, size_t line, size_t column) {
+        if (doc.index == nullptr) {
+            doc.index = std::make_unique<NodeIndex>(ast(doc));
+        }
+
+        NodeLookup found = doc.index->find(line, column);
+        json loops = json::array();
+
+        for (const LoopNode* loop: found.loops) {
+            loops.push_back(node_range_to_json(loop));
+        }
+
+        json result = { { "node", nullptr }, { "loops", loops }, { "match", nullptr } };
+        if (found.node != nullptr) {
+            result["node"] = node_range_to_json(found.node);
+            result["node"]["type"] = node_type_name(found.node->type);
+        }
+        if (found.has_match) {
+            result["match"] = { { "line", found.match_line }, { "column", found.match_column } };
+        }
+        return result;
+    }
+
+    json lint(Document& doc) {
+        json diagnostics = json::array();
+
+        lint_tree(ast(doc), [&](const LintDiagnostic& diagnostic) { diagnostics.push_back(diagnostic_to_json(diagnostic)); });
+        return diagnostics;
+    }
+
+    json format(const std::string& path, Document& doc, bool write) {
+        std::string formatted = format_tree(ast(doc), fmt_config, cache);
+        LineIndex lines(doc.text);
+        json edits = json::array();
+
+        for (const auto& edit: formatting_edits(doc.text, formatted)) {
+            edits.push_back(edit_to_json(edit, lines));
+        }
+
+        bool changed = formatted != doc.text;
+
+        if (write && changed) {
+            write_file(path, formatted);
+            doc.text = std::move(formatted);
+            doc.version++;
+            doc.ast.reset();
+            doc.index.reset();
+        }
+        return { { "changed", changed }, { "edits", edits }, { "version", doc.version } };
+    }
+};
+
+int serve(std::istream& in, std::ostream& out) {
+    Server server(in, out);
+    return server.run();
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+
+// Long-running analysis server speaking JSON-RPC 2.0 with one message per
+// line. Documents and their parsed ASTs stay in memory between requests, so a
+// lint followed by a format of the same text parses it only once.
+//
+// Methods (params in braces, "text" always optional):
+//   open {path, text, version}    load a document, from disk if text is missing
+//   change {path, text, version}  replace the text of a document
+//   close {path}                  forget a document
+//   lint {path, text}             -> array of diagnostics, as printed by lint
+//   format {path, text, write}    -> {changed, edits}; write also updates the file
+//   debug {path, text}            -> {ast, diagnostics, formatted}
+//   shutdown                      -> null, then the server exits
+int serve(std::istream& in, std::ostream& out);
@@ -0,0 +1,53 @@
+#include "source.hpp"
+#include <algorithm>
+
+LineIndex::LineIndex(std::string_view source): source_size(source.size()) {
+    line_starts.push_back(0);
+
+    for (size_t i = 0; i < source.size(); ++i) {
+        if (source[i] == '\n') {
+            line_starts.push_back(i + 1);
+        }
+    }
+}
+
+size_t LineIndex::offset(size_t line, size_t column) const {
+    if (line == 0) {
+        return 0;
+    }
+    if (line > line_starts.size()) {
+        return source_size;
+    }
+    return std::min(line_starts[line - 1] + (column > 0 ? column - 1 : 0), source_size);
+}
+
+size_t LineIndex::line_of(size_t offset) const {
+    auto it = std::upper_bound(line_starts.begin(), line_starts.end(), offset);
+    return static_cast<size_t>(it - line_starts.begin());
+}
+
+size_t LineIndex::line_start(size_t line) const {
+    if (line == 0) {
+        return 0;
+    }
+    if (line > line_starts.size()) {
+        return source_size;
+    }
+    return line_starts[line - 1];
+}
+
+std::string apply_edits(std::string_view source, const std::vector<TextEdit>& edits) {
+    std::string result;
+    size_t position = 0;
+
+    result.reserve(source.size());
+
+    for (const auto& edit: edits) {
+        result.append(source.substr(position, edit.start_offset - position));
+        result += edit.replacement;
+        position = edit.end_offset;
+    }
+    result.append(source.substr(position));
+
+    return result;
+}
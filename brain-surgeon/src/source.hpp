@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Maps the 1-based line/column positions stored in tokens and AST nodes to
+// byte offsets in the source text and back
+class LineIndex {
+public:
+    explicit LineIndex(std::string_view source);
+
+    size_t offset(size_t line, size_t column) const;
+    size_t line_of(size_t offset) const;
+    size_t line_start(size_t line) const;
+    size_t line_count() const { return line_starts.size(); }
+    size_t size() const { return source_size; }
+
+private:
+    std::vector<size_t> line_starts; // byte offset of the first character of every line
+    size_t source_size;
+};
+
+// Replace the bytes [start_offset, end_offset) of a source with replacement
+struct TextEdit {
+    size_t start_offset;
+    size_t end_offset;
+    std::string replacement;
+};
+
+// Apply sorted, non-overlapping edits in a single pass over the source
+std::string apply_edits(std::string_view source, const std::vector<TextEdit>& edits);
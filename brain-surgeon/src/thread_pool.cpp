@@ -0,0 +1,147 @@
+#include "thread_pool.hpp"
+#include <algorithm>
+
+// The pool and index of the worker running on the current thread
+static thread_local const ThreadPool* current_pool = nullptr;
+static thread_local size_t current_index = 0;
+
+ThreadPool::ThreadPool(size_t threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    queues.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+
+    workers.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([this, i]() { run(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    task_available.notify_all();
+
+    for (auto& worker: workers) {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::worker_index() const {
+    return current_pool == this ? current_index : workers.size();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    size_t index = worker_index();
+    if (index == workers.size()) {
+        index = next_queue++ % queues.size();
+    }
+
+    // Counted first, so that the task can never finish before it is counted
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        unfinished++;
+        queued++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    task_available.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    all_done.wait(lock, [this]() { return unfinished == 0; });
+
+    if (error) {
+        std::exception_ptr first_error = error;
+        error = nullptr;
+        std::rethrow_exception(first_error);
+    }
+}
+
+bool ThreadPool::take_task(size_t index, std::function<void()>& task) {
+    // Newest task of our own deque, it is the most likely to be cache-warm
+    {
+        WorkQueue& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queued--;
+            return true;
+        }
+    }
+
+    // Oldest task of the next worker that has one
+    for (size_t offset = 1; offset < queues.size(); ++offset) {
+        WorkQueue& victim = *queues[(index + offset) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queued--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::run(size_t index) {
+    current_pool = this;
+    current_index = index;
+
+    while (true) {
+        std::function<void()> task;
+
+        if (!take_task(index, task)) {
+            std::unique_lock<std::mutex> lock(mutex);
+            task_available.wait(lock, [this]() { return stopping || queued > 0; });
+
+            if (stopping && queued == 0) {
+                return;
+            }
+            continue;
+        }
+
+        std::exception_ptr task_error;
+        try {
+            task();
+        } catch (...) {
+            task_error = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (task_error && !error) {
+            error = task_error;
+        }
+        if (--unfinished == 0) {
+            all_done.notify_all();
+        }
+    }
+}
+
+void parallel_for(ThreadPool& pool, size_t count, const std::function<void(size_t)>& body) {
+    // Every worker pulls the next index, so uneven items balance out
+    std::atomic<size_t> next { 0 };
+    size_t runners = std::min(pool.size(), count);
+
+    for (size_t r = 0; r < runners; ++r) {
+        pool.submit([&]() {
+            for (size_t i = next++; i < count; i = next++) {
+                body(i);
+            }
+        });
+    }
+    pool.wait();
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads with one task deque each. Workers take their
+// own newest task first and steal the oldest task of another worker when
+// they run dry, so a few slow tasks never leave the other threads idle.
+class ThreadPool {
+public:
+    // A thread count of 0 uses one thread per hardware thread
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Tasks submitted by a worker go to its own deque, others are spread
+    // over all workers
+    void submit(std::function<void()> task);
+
+    // Block until every submitted task has finished, rethrowing the first
+    // exception a task raised
+    void wait();
+
+    size_t size() const { return workers.size(); }
+
+    // Index of the calling worker thread of this pool, or size() elsewhere
+    size_t worker_index() const;
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void run(size_t index);
+    bool take_task(size_t index, std::function<void()>& task);
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::atomic<size_t> next_queue { 0 };
+    std::atomic<size_t> queued { 0 };
+
+    std::mutex mutex; // guards the counters below and the sleeping workers
+    std::condition_variable task_available;
+    std::condition_variable all_done;
+    size_t unfinished = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+};
+
+// Run body(i) for every i in [0, count) on the pool and wait for all of them
+void parallel_for(ThreadPool& pool, size_t count, const std::function<void(size_t)>& body);
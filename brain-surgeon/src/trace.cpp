@@ -0,0 +1,122 @@
+#include "trace.hpp"
+#include "json_writer.hpp"
+#include <algorithm>
+#include <atomic>
+
+static std::atomic<uint64_t> next_recorder_serial { 1 };
+
+TraceRecorder::TraceRecorder(size_t events_per_thread): start(Clock::now()), capacity(std::max<size_t>(events_per_thread, 1)), serial(next_recorder_serial++) {}
+
+TraceRecorder::ThreadBuffer& TraceRecorder::thread_buffer() {
+    // Cached per thread; the serial keeps a recorder created at the address
+    // of an old one from using the old buffer
+    thread_local uint64_t cached_serial = 0;
+    thread_local ThreadBuffer* cached = nullptr;
+
+    if (cached_serial != serial) {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+
+        buffers.push_back(std::make_unique<ThreadBuffer>());
+        cached = buffers.back().get();
+        cached->thread_id = buffers.size();
+        cached->events.resize(capacity);
+        cached_serial = serial;
+    }
+    return *cached;
+}
+
+int64_t TraceRecorder::since_start(Clock::time_point time) const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time - start).count();
+}
+
+void TraceRecorder::push(ThreadBuffer& buffer, const Event& event) {
+    buffer.events[buffer.recorded % capacity] = event;
+    buffer.recorded++;
+}
+
+void TraceRecorder::span(const char* name, Clock::time_point span_start, Clock::time_point span_end) {
+    ThreadBuffer& buffer = thread_buffer();
+    push(buffer, { name, buffer.current_file, since_start(span_start), since_start(span_end) - since_start(span_start) });
+}
+
+void TraceRecorder::begin_file(const std::string& file) {
+    ThreadBuffer& buffer = thread_buffer();
+
+    buffer.current_file = static_cast<uint32_t>(buffer.files.size());
+    buffer.files.push_back(file);
+    buffer.file_start = Clock::now();
+}
+
+void TraceRecorder::end_file() {
+    ThreadBuffer& buffer = thread_buffer();
+
+    if (buffer.current_file != NO_FILE) {
+        int64_t file_start = since_start(buffer.file_start);
+        push(buffer, { nullptr, buffer.current_file, file_start, since_start(Clock::now()) - file_start });
+        buffer.current_file = NO_FILE;
+    }
+}
+
+// Trace timestamps are microseconds; nanoseconds are kept as decimals
+static void append_microseconds(std::string& out, int64_t nanoseconds) {
+    append_json_number(out, static_cast<size_t>(nanoseconds / 1000));
+    out += '.';
+
+    std::string fraction = std::to_string(nanoseconds % 1000);
+    out.append(3 - fraction.size(), '0');
+    out += fraction;
+}
+
+void TraceRecorder::write(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    std::string text = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+
+    auto begin_event = [&]() {
+        text += first ? "\n" : ",\n";
+        first = false;
+    };
+
+    for (const auto& buffer: buffers) {
+        std::string thread = std::to_string(buffer->thread_id);
+
+        begin_event();
+        text += "{\"args\":{\"name\":";
+        append_json_string(text, "thread " + thread);
+        text += "},\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + thread + "}";
+
+        // Oldest first; a wrapped ring starts at its next write position
+        uint64_t count = std::min<uint64_t>(buffer->recorded, capacity);
+        for (uint64_t i = buffer->recorded - count; i < buffer->recorded; ++i) {
+            const Event& event = buffer->events[i % capacity];
+            const std::string* file = event.file != NO_FILE ? &buffer->files[event.file] : nullptr;
+
+            begin_event();
+            text += "{";
+            if (file != nullptr) {
+                text += "\"args\":{\"file\":";
+                append_json_string(text, *file);
+                text += "},";
+            }
+            text += "\"cat\":";
+            text += event.name != nullptr ? "\"phase\"" : "\"file\"";
+            text += ",\"dur\":";
+            append_microseconds(text, event.duration);
+            text += ",\"name\":";
+            append_json_string(text, event.name != nullptr ? std::string(event.name) : *file);
+            text += ",\"ph\":\"X\",\"pid\":1,\"tid\":" + thread + ",\"ts\":";
+            append_microseconds(text, event.start);
+            text += "}";
+        }
+
+        if (buffer->recorded > capacity) {
+            begin_event();
+            text += "{\"args\":{\"dropped\":";
+            append_json_number(text, static_cast<size_t>(buffer->recorded - capacity));
+            text += "},\"name\":\"dropped_events\",\"ph\":\"M\",\"pid\":1,\"tid\":" + thread + "}";
+        }
+    }
+
+    text += "\n]}\n";
+    out << text;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Collects timed spans from any number of threads and writes them as Chrome
+// trace-event JSON (chrome://tracing, Perfetto). Every thread records into a
+// ring buffer of its own, so recording takes no lock; a thread that records
+// more than fits keeps only its newest spans.
+class TraceRecorder {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit TraceRecorder(size_t events_per_thread = 1 << 16);
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    // name must outlive the recorder, e.g. a string literal
+    void span(const char* name, Clock::time_point start, Clock::time_point end);
+
+    // Spans recorded by the calling thread between these two belong to file
+    void begin_file(const std::string& file);
+    void end_file();
+
+    // Only call once every recording thread is done
+    void write(std::ostream& out) const;
+
+private:
+    static constexpr uint32_t NO_FILE = UINT32_MAX;
+
+    struct Event {
+        const char* name; // nullptr for the span of a whole file
+        uint32_t file;    // index into the files of the thread
+        int64_t start;    // nanoseconds since the recorder was created
+        int64_t duration;
+    };
+
+    struct ThreadBuffer {
+        size_t thread_id;
+        std::vector<Event> events;
+        uint64_t recorded = 0; // events ever recorded, events[recorded % size] is next
+        std::vector<std::string> files;
+        uint32_t current_file = NO_FILE;
+        Clock::time_point file_start;
+    };
+
+    ThreadBuffer& thread_buffer();
+    void push(ThreadBuffer& buffer, const Event& event);
+    int64_t since_start(Clock::time_point time) const;
+
+    Clock::time_point start;
+    size_t capacity;
+    uint64_t serial; // tells the thread buffers of different recorders apart
+    mutable std::mutex buffers_mutex; // only taken when a thread records for the first time
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};
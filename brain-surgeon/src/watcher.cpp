@@ -0,0 +1,358 @@
+#include "watcher.hpp"
+#include "batch.hpp"
+#include "file_io.hpp"
+#include "file_walker.hpp"
+#include "format_cache.hpp"
+#include "formatter.hpp"
+#include "json_writer.hpp"
+#include "linter.hpp"
+#include "parser.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <poll.h>
+#include <set>
+#include <stdexcept>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+// The events of a burst are collected until nothing happened for
+// QUIET_PERIOD_MS, but a constant stream of changes is still reported at
+// least every MAX_DELAY_MS
+static constexpr int QUIET_PERIOD_MS = 50;
+static constexpr int MAX_DELAY_MS = 1000;
+
+static constexpr uint32_t WATCH_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_ONLYDIR;
+
+static bool starts_with(std::string_view text, std::string_view prefix) {
+    return text.size() >= prefix.size() && text.compare(0, prefix.size(), prefix) == 0;
+}
+
+class Watcher {
+public:
+    Watcher(const WatchOptions& options, std::ostream& out, std::ostream& err): options(options), out(out), err(err), pool(options.jobs) {
+        inotify_fd = inotify_init1(IN_CLOEXEC);
+        if (inotify_fd < 0) {
+            throw std::runtime_error(std::string("Cannot start watching: ") + std::strerror(errno));
+        }
+    }
+    ~Watcher() { close(inotify_fd); }
+
+    Watcher(const Watcher&) = delete;
+    Watcher& operator=(const Watcher&) = delete;
+
+    int run(const std::vector<std::string>& watch_roots) {
+        std::set<std::string> changed;
+        std::set<std::string> deleted;
+
+        for (const auto& root: watch_roots) {
+            struct stat info;
+            if (stat(root.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+                err << "Error: not a directory: " << root << "\n";
+                return 1;
+            }
+            roots.push_back(root);
+            add_directory(root, nullptr, changed);
+        }
+
+        while (!directories.empty()) {
+            process(changed, deleted);
+            changed.clear();
+            deleted.clear();
+            wait_for_changes(changed, deleted);
+        }
+        process(changed, deleted);
+        return 0;
+    }
+
+private:
+    struct WatchedDirectory {
+        std::string prefix; // with a trailing '/'
+        std::shared_ptr<const IgnoreRules> rules;
+    };
+
+    const WatchOptions& options;
+    std::ostream& out;
+    std::ostream& err;
+    int inotify_fd;
+    ThreadPool pool;
+
+    std::vector<std::string> roots;
+    std::unordered_map<int, WatchedDirectory> directories; // by watch descriptor
+
+    // The same files as the directory walk of lint and fmt
+    SourceFilter filter;
+
+    // Hash of the text each file had when it was last reported, so that files
+    // rewritten with the same content, and the writes of --fmt itself, are
+    // not reported again
+    std::mutex seen_mutex;
+    std::unordered_map<std::string, size_t> seen;
+
+    // Watch a directory and everything below it that is not ignored, adding
+    // the files found to files. Ignore files are read once, when the
+    // directory is added.
+    void add_directory(const std::string& directory, std::shared_ptr<const IgnoreRules> rules, std::set<std::string>& files) {
+        std::string prefix = directory.back() == '/' ? directory : directory + '/';
+        rules = filter.directory_rules(prefix, std::move(rules));
+
+        // Watch before listing, so nothing created in between is missed
+        int wd = inotify_add_watch(inotify_fd, directory.c_str(), WATCH_EVENTS);
+        if (wd < 0) {
+            err << "Error: cannot watch directory: " << directory << " (" << std::strerror(errno) << ")\n";
+            return;
+        }
+        directories[wd] = { prefix, rules };
+
+        std::vector<std::pair<std::string, bool>> entries;
+        if (!filter.list(prefix, rules.get(), entries)) {
+            return;
+        }
+
+        for (auto& [path, is_directory]: entries) {
+            if (is_directory) {
+                add_directory(path, rules, files);
+            } else {
+                files.insert(std::move(path));
+            }
+        }
+    }
+
+    // Stop watching a directory that was moved away or deleted, and report
+    // the files that were in it
+    void forget_directory(const std::string& prefix, std::set<std::string>& changed, std::set<std::string>& deleted) {
+        for (auto it = directories.begin(); it != directories.end();) {
+            if (starts_with(it->second.prefix, prefix)) {
+                inotify_rm_watch(inotify_fd, it->first);
+                it = directories.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(seen_mutex);
+        for (const auto& [path, hash]: seen) {
+            if (starts_with(path, prefix)) {
+                changed.erase(path);
+                deleted.insert(path);
+            }
+        }
+    }
+
+    // Events were lost, so start over from the roots; unchanged files are
+    // skipped by their hash
+    void rescan(std::set<std::string>& changed, std::set<std::string>& deleted) {
+        for (const auto& [wd, directory]: directories) {
+            inotify_rm_watch(inotify_fd, wd);
+        }
+        directories.clear();
+
+        changed.clear();
+        for (const auto& root: roots) {
+            add_directory(root, nullptr, changed);
+        }
+
+        std::lock_guard<std::mutex> lock(seen_mutex);
+        for (const auto& [path, hash]: seen) {
+            if (changed.count(path) == 0) {
+                deleted.insert(path);
+            }
+        }
+    }
+
+    // Returns false if there was nothing to read
+    bool read_events(std::set<std::string>& changed, std::set<std::string>& deleted) {
+        alignas(inotify_event) char buffer[64 * 1024];
+        ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+
+        if (length <= 0) {
+            return false;
+        }
+
+        for (char* position = buffer; position < buffer + length;) {
+            const auto* event = reinterpret_cast<const inotify_event*>(position);
+            position += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                rescan(changed, deleted);
+                continue;
+            }
+
+            auto found = directories.find(event->wd);
+            if (found == directories.end()) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                directories.erase(found);
+                continue;
+            }
+            if (event->len == 0) {
+                continue; // the directory itself; its removal ends with IN_IGNORED
+            }
+
+            const WatchedDirectory& directory = found->second;
+            std::string path = directory.prefix + event->name;
+            bool is_directory = (event->mask & IN_ISDIR) != 0;
+
+            if (!filter.accepts(path, is_directory, directory.rules.get())) {
+                continue;
+            }
+
+            if (is_directory) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    add_directory(path, directory.rules, changed);
+                } else if (event->mask & (IN_MOVED_FROM | IN_DELETE)) {
+                    forget_directory(path + '/', changed, deleted);
+                }
+            } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                deleted.erase(path);
+                changed.insert(path);
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                changed.erase(path);
+                deleted.insert(path);
+            }
+        }
+        return true;
+    }
+
+    static int milliseconds_since(std::chrono::steady_clock::time_point start) {
+        return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    // Block until something changed, then collect the rest of the burst
+    void wait_for_changes(std::set<std::string>& changed, std::set<std::string>& deleted) {
+        pollfd descriptor { inotify_fd, POLLIN, 0 };
+        std::chrono::steady_clock::time_point burst_start;
+        bool in_burst = false;
+
+        while (!directories.empty()) {
+            int timeout = in_burst ? std::min(QUIET_PERIOD_MS, std::max(0, MAX_DELAY_MS - milliseconds_since(burst_start))) : -1;
+            int ready = poll(&descriptor, 1, timeout);
+
+            if (ready < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ready <= 0) {
+                if (in_burst) {
+                    return;
+                }
+                throw std::runtime_error(std::string("Cannot wait for changes: ") + std::strerror(errno));
+            }
+
+            read_events(changed, deleted);
+            if (!in_burst && (!changed.empty() || !deleted.empty())) {
+                in_burst = true;
+                burst_start = std::chrono::steady_clock::now();
+            }
+            if (in_burst && milliseconds_since(burst_start) >= MAX_DELAY_MS) {
+                return;
+            }
+        }
+    }
+
+    // Remember the text of a file; false if it is what was last reported
+    bool remember(const std::string& path, std::string_view text) {
+        size_t hash = std::hash<std::string_view>()(text);
+        std::lock_guard<std::mutex> lock(seen_mutex);
+        auto [entry, inserted] = seen.emplace(path, hash);
+
+        if (!inserted && entry->second == hash) {
+            return false;
+        }
+        entry->second = hash;
+        return true;
+    }
+
+    bool forget(const std::string& path) {
+        std::lock_guard<std::mutex> lock(seen_mutex);
+        return seen.erase(path) > 0;
+    }
+
+    static std::string deleted_line(const std::string& path) {
+        std::string line = "{\"file\":";
+        append_json_string(line, path);
+        line += ",\"deleted\":true}\n";
+        return line;
+    }
+
+    FileReport analyze(const std::string& path) {
+        // Kept per worker thread, so every burst reuses the buffers and the
+        // rendered loops of the ones before
+        thread_local BrainfuckLexer lexer;
+        thread_local BrainfuckParser parser;
+        thread_local std::vector<Token> tokens;
+        thread_local FormatCache cache;
+
+        FileReport report;
+        struct stat info;
+
+        // Removed again since the event came in
+        if (stat(path.c_str(), &info) != 0) {
+            if (forget(path)) {
+                report.out = deleted_line(path);
+            }
+            return report;
+        }
+
+        std::string text = read_file(path);
+        if (!remember(path, text)) {
+            return report;
+        }
+
+        auto parse = [&](ParseMode mode) {
+            lexer.tokenize(text, tokens);
+            return parser.parse(tokens, mode);
+        };
+
+        std::string line = "{\"file\":";
+        append_json_string(line, path);
+
+        if (options.format) {
+            auto ast = parse(ParseMode::FULL);
+            std::string formatted = format_tree(ast.get(), options.fmt_config, cache);
+            bool changed = update_file(path, formatted, text);
+
+            // The event for this write finds the same hash and is skipped
+            if (changed) {
+                text = std::move(formatted);
+                remember(path, text);
+            }
+            line += changed ? ",\"formatted\":true" : ",\"formatted\":false";
+        }
+
+        line += ",\"diagnostics\":";
+        line += lint_to_json(parse(ParseMode::TRIVIA_FREE).get());
+        line += "}\n";
+
+        report.out = std::move(line);
+        return report;
+    }
+
+    void process(const std::set<std::string>& changed, const std::set<std::string>& deleted) {
+        for (const auto& path: deleted) {
+            if (forget(path)) {
+                out << deleted_line(path);
+            }
+        }
+
+        run_batch(
+            pool, std::vector<std::string>(changed.begin(), changed.end()), [this](const std::string& path) { return analyze(path); }, out, err);
+        out.flush();
+        err.flush();
+    }
+};
+
+int watch(const std::vector<std::string>& roots, const WatchOptions& options, std::ostream& out, std::ostream& err) {
+    try {
+        Watcher watcher(options, out, err);
+        return watcher.run(roots);
+    } catch (const std::exception& e) {
+        err << "Error: " << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "formatter_config.hpp"
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct WatchOptions {
+    bool format = false; // reformat changed files before linting them
+    size_t jobs = 1;
+    FormatterConfig fmt_config;
+};
+
+// Lint every .bf and .b file under roots, then keep watching the trees with
+// inotify and re-analyze the files that change. Reports are NDJSON lines:
+// {"file": ..., "diagnostics": [...]} ("formatted" is added with
+// options.format) and {"file": ..., "deleted": true}. Returns once none of the
+// directories is left, or 1 if watching cannot start.
+int watch(const std::vector<std::string>& roots, const WatchOptions& options, std::ostream& out, std::ostream& err);
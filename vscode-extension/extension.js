@@ -1,62 +1,133 @@
 const vscode = require("vscode");
-const { exec } = require("child_process");
+const { spawn } = require("child_process");
+const readline = require("readline");
 
-const runLint = (document, collection) => {
-    if (document.languageId !== "brainfuck") return;
-
-    exec(`brain-surgeon lint ${document.uri.fsPath}`, (err, stdout, stderr) => {
-        console.log("Brain Surgeon linting");
+// One long-running `brain-surgeon serve` process answers every request, so a
+// save costs neither process startups nor re-reading and re-parsing the file
+const createServer = () => {
+    const server = spawn("brain-surgeon", ["serve"]);
+    const pending = new Map();
+    let nextId = 1;
 
-        const diagnostics = [];
-        let lintResults = [];
+    readline.createInterface({ input: server.stdout }).on("line", line => {
+        let message;
 
         try {
-            lintResults = JSON.parse(stdout);
+            message = JSON.parse(line);
         } catch (e) {
-            vscode.window.showErrorMessage("Brain Surgeon linting failed: Invalid JSON output.");
+            console.log("Brain Surgeon sent invalid JSON: " + line);
             return;
         }
 
-        for (const item of lintResults) {
-            const range = new vscode.Range(
-                new vscode.Position(item.startLine - 1, item.startColumn - 1),
-                new vscode.Position(item.endLine - 1, item.endColumn)
-            );
-
-            const diagnostic = new vscode.Diagnostic(
-                range,
-                item.message,
-                {
-                    "info": vscode.DiagnosticSeverity.Information,
-                    "warning": vscode.DiagnosticSeverity.Warning,
-                    "error": vscode.DiagnosticSeverity.Error,
-                    "hint": vscode.DiagnosticSeverity.Hint,
-                }[item.level.toLowerCase()]
-            );
-
-            diagnostics.push(diagnostic);
+        const request = pending.get(message.id);
+        if (!request) return;
+
+        pending.delete(message.id);
+        if (message.error) {
+            request.reject(new Error(message.error.message));
+        } else {
+            request.resolve(message.result);
         }
+    });
 
-        collection.set(document.uri, diagnostics);
-        console.log("Brain Surgeon linted");
+    server.on("error", err => {
+        vscode.window.showErrorMessage(`Brain Surgeon could not be started: ${err.message}`);
     });
+
+    server.on("exit", () => {
+        for (const request of pending.values()) {
+            request.reject(new Error("Brain Surgeon server exited"));
+        }
+        pending.clear();
+    });
+
+    const request = (method, params) => new Promise((resolve, reject) => {
+        const id = nextId++;
+
+        pending.set(id, { resolve, reject });
+        server.stdin.write(JSON.stringify({ jsonrpc: "2.0", id, method, params }) + "\n");
+    });
+
+    const notify = (method, params) => {
+        server.stdin.write(JSON.stringify({ jsonrpc: "2.0", method, params }) + "\n");
+    };
+
+    const dispose = () => {
+        request("shutdown", {}).catch(() => { });
+        server.stdin.end();
+    };
+
+    return { request, notify, dispose };
 };
 
-const runFormat = (document) => {
+const runLint = async (server, document, collection) => {
     if (document.languageId !== "brainfuck") return;
 
-    exec(`brain-surgeon fmt ${document.uri.fsPath}`, (_err, stdout, _stderr) => {
-        vscode.window.showInformationMessage(stdout);
-    });
+    console.log("Brain Surgeon linting");
+
+    let lintResults = [];
+
+    try {
+        lintResults = await server.request("lint", { path: document.uri.fsPath, text: document.getText() });
+    } catch (e) {
+        vscode.window.showErrorMessage(`Brain Surgeon linting failed: ${e.message}`);
+        return;
+    }
+
+    const diagnostics = [];
+
+    for (const item of lintResults) {
+        const range = new vscode.Range(
+            new vscode.Position(item.startLine - 1, item.startColumn - 1),
+            new vscode.Position(item.endLine - 1, item.endColumn)
+        );
+
+        const diagnostic = new vscode.Diagnostic(
+            range,
+            item.message,
+            {
+                "info": vscode.DiagnosticSeverity.Information,
+                "warning": vscode.DiagnosticSeverity.Warning,
+                "error": vscode.DiagnosticSeverity.Error,
+                "hint": vscode.DiagnosticSeverity.Hint,
+            }[item.level.toLowerCase()]
+        );
+
+        diagnostics.push(diagnostic);
+    }
+
+    collection.set(document.uri, diagnostics);
+    console.log("Brain Surgeon linted");
+};
+
+const runFormat = async (server, document) => {
+    if (document.languageId !== "brainfuck") return;
+
+    try {
+        // Reuses the text and AST the lint request just sent
+        const result = await server.request("format", { path: document.uri.fsPath, write: true });
+        const path = document.uri.fsPath;
+
+        vscode.window.showInformationMessage(result.changed ? `Formatted and wrote to ${path}` : `Already formatted ${path}`);
+    } catch (e) {
+        vscode.window.showErrorMessage(`Brain Surgeon formatting failed: ${e.message}`);
+    }
 };
 
 const activate = (context) => {
     const diagnosticCollection = vscode.languages.createDiagnosticCollection("brain-surgeon");
+    const server = createServer();
 
-    vscode.workspace.onDidSaveTextDocument(doc => runLint(doc, diagnosticCollection));
-    vscode.workspace.onDidSaveTextDocument(doc => runFormat(doc));
+    vscode.workspace.onDidSaveTextDocument(async doc => {
+        await runLint(server, doc, diagnosticCollection);
+        await runFormat(server, doc);
+    });
+    vscode.workspace.onDidCloseTextDocument(doc => {
+        if (doc.languageId === "brainfuck") server.notify("close", { path: doc.uri.fsPath });
+    });
 
     context.subscriptions.push(diagnosticCollection);
+    context.subscriptions.push({ dispose: server.dispose });
 
     vscode.window.showInformationMessage("Brain Surgeon is active!");
 };